@@ -24,8 +24,10 @@ CC0_OPTIONS = ['-d', '--no-log', "--save-files", "--standard=c0"]
 OPT_BEFORE_PASSES = ['-mem2reg', '-jump-threading', '-loops', '-loop-simplify']
 CLANG_OPTIONS = ["-I" + path for path in CC0_INCLUDE_PATHS] + [
     '-S', '-emit-llvm',
-    '-O0', '-std=c99', '-fwrapv', '-w', '-g',
-    '-D', 'COMPILING_FOR_Z0']
+    '-O0', '-std=c99', '-fwrapv', '-w', '-g']
+# Turns contracts into plain z0_* calls; left out when stripping, whose
+# bitcode has to assert them
+Z0_DEFINES = ['-D', 'COMPILING_FOR_Z0']
 Z0_PASS_LOAD = [
     "-load", "/home/user/z3-4.5.0-x64-debian-8.5/bin/libz3.so",
     "-load", Z0_PREFIX + "lib/z0.so"]
@@ -43,13 +45,50 @@ def main(args):
     ll_file = filename + ".ll"
     if args.debug_pass:
         Z0_PASS_LOAD.append('-debug')
+    z0_options = ['-z0-jobs=' + str(args.jobs),
+                  '-z0-path-jobs=' + str(args.path_jobs)]
+    if args.merge:
+        z0_options.append('-z0-merge')
+    if args.incremental:
+        z0_options.append('-z0-incremental')
+    if args.query_cache:
+        z0_options.append('-z0-query-cache=' + str(args.query_cache))
+    if args.slice:
+        z0_options.append('-z0-slice')
+    if args.substitute:
+        z0_options.append('-z0-substitute')
+    if args.portfolio:
+        z0_options.append('-z0-portfolio')
+    z0_options.append('-z0-int-abstraction=' + str(args.int_abstraction))
+    z0_options.append('-z0-cores=' + str(args.cores))
+    if args.prepass:
+        z0_options.append('-z0-prepass')
+    if args.stats:
+        z0_options.append('-z0-stats')
+    if args.result_cache:
+        z0_options.append('-z0-result-cache=' + args.result_cache)
+    z0_options += ['-z0-search=' + args.search,
+                   '-z0-max-paths=' + str(args.max_paths),
+                   '-z0-max-depth=' + str(args.max_depth),
+                   '-z0-unroll=' + str(args.unroll),
+                   '-z0-concrete=' + str(args.concrete),
+                   '-z0-time-budget=' + str(args.time_budget),
+                   '-z0-module-time-budget=' + str(args.module_time_budget),
+                   '-z0-query-timeout=' + str(args.query_timeout),
+                   '-z0-query-rlimit=' + str(args.query_rlimit),
+                   '-z0-memory-limit=' + str(args.memory_limit)]
 
     # Compile C0 to C
     cc0_options = CC0_LIBOPTIONS + CC0_OPTIONS + args.files
     sp.check_call([CC0, '-o', args.output] + cc0_options)  # stderr=sp.DEVNULL)
 
-    # Generate llvm bitcode with clang
-    sp.check_call([CLANG, c_file, '-o', bc_file] + CLANG_OPTIONS)
+    # Generate llvm bitcode with clang. Stripping checks needs the bitcode
+    # that would be shipped, with its contracts asserted; Z0 skips the
+    # c0_assert calls and checks the contracts themselves.
+    clang_options = CLANG_OPTIONS
+    if not args.strip:
+        clang_options = CLANG_OPTIONS + Z0_DEFINES
+    sp.check_call([CLANG, c_file, '-o', bc_file] + clang_options)
 
     # Analyze llvm code
     sp.check_call([OPT, bc_file, '-o', opt_file] + OPT_BEFORE_PASSES)
@@ -59,7 +98,11 @@ def main(args):
     else:
         os.remove(c_file)
 
-    sp.check_call([OPT, opt_file, '-o', os.path.devnull] + Z0_PASS_LOAD + OPT_BEFORE_PASSES + Z0_PASS_NAME)
+    if args.strip:
+        print("Outputting bitcode without proved checks to", args.strip)
+        sp.check_call([OPT, opt_file, '-o', args.strip] + Z0_PASS_LOAD + OPT_BEFORE_PASSES + ['-z0-strip'] + z0_options)
+    else:
+        sp.check_call([OPT, opt_file, '-o', os.path.devnull] + Z0_PASS_LOAD + OPT_BEFORE_PASSES + Z0_PASS_NAME + z0_options)
 
     os.remove(h_file)
     os.remove(bc_file)
@@ -81,6 +124,157 @@ if __name__ == '__main__':
         dest="debug_pass",
         action='store_true',
         help='enable debug logging')
+    PARSER.add_argument(
+        '-j', '--jobs',
+        metavar='N',
+        dest='jobs',
+        type=int,
+        default=1,
+        help='check N functions in parallel (0 = one per core)')
+    PARSER.add_argument(
+        '--path-jobs',
+        metavar='N',
+        dest='path_jobs',
+        type=int,
+        default=1,
+        help='explore the paths of each function on N threads')
+    PARSER.add_argument(
+        '-m', '--merge',
+        dest='merge',
+        action='store_true',
+        help='merge paths at join points instead of forking')
+    PARSER.add_argument(
+        '-i', '--incremental',
+        dest='incremental',
+        action='store_true',
+        help='keep solver state across paths instead of pushing and popping')
+    PARSER.add_argument(
+        '--query-cache',
+        metavar='N',
+        dest='query_cache',
+        type=int,
+        default=0,
+        help='remember N solver results per function (default: no cache)')
+    PARSER.add_argument(
+        '--slice',
+        dest='slice',
+        action='store_true',
+        help='only check the constraints each query depends on')
+    PARSER.add_argument(
+        '--substitute',
+        dest='substitute',
+        action='store_true',
+        help='encode instructions as expressions instead of equations')
+    PARSER.add_argument(
+        '--portfolio',
+        dest='portfolio',
+        action='store_true',
+        help='race several solver strategies on each query')
+    PARSER.add_argument(
+        '--int-abstraction',
+        metavar='MS',
+        dest='int_abstraction',
+        type=int,
+        default=0,
+        help='try arithmetic-heavy queries over the integers for MS milliseconds first (0 = never)')
+    PARSER.add_argument(
+        '--cores',
+        metavar='N',
+        dest='cores',
+        type=int,
+        default=0,
+        help='remember the unsat cores of N infeasible paths per function (0 = none)')
+    PARSER.add_argument(
+        '--prepass',
+        dest='prepass',
+        action='store_true',
+        help='decide what queries intervals can before asking the solver')
+    PARSER.add_argument(
+        '-s', '--stats',
+        dest='stats',
+        action='store_true',
+        help='print statistics when done')
+    PARSER.add_argument(
+        '--search',
+        dest='search',
+        choices=['dfs', 'bfs', 'priority'],
+        default='dfs',
+        help='order in which to explore paths')
+    PARSER.add_argument(
+        '--max-paths',
+        metavar='N',
+        dest='max_paths',
+        type=int,
+        default=0,
+        help='give up on a function after N paths (0 = no limit)')
+    PARSER.add_argument(
+        '--max-depth',
+        metavar='N',
+        dest='max_depth',
+        type=int,
+        default=0,
+        help='stop following a path after N blocks (0 = no limit)')
+    PARSER.add_argument(
+        '--unroll',
+        metavar='N',
+        dest='unroll',
+        type=int,
+        default=0,
+        help='unroll loops without invariants up to N times, deepening as time allows (0 = havoc them)')
+    PARSER.add_argument(
+        '--concrete',
+        metavar='N',
+        dest='concrete',
+        type=int,
+        default=0,
+        help='run each function on N boundary and random inputs before checking it (0 = don\'t)')
+    PARSER.add_argument(
+        '--time-budget',
+        metavar='SECONDS',
+        dest='time_budget',
+        type=int,
+        default=0,
+        help='give up on a function after SECONDS (0 = no limit)')
+    PARSER.add_argument(
+        '--module-time-budget',
+        metavar='SECONDS',
+        dest='module_time_budget',
+        type=int,
+        default=0,
+        help='give up on the whole program after SECONDS (0 = no limit)')
+    PARSER.add_argument(
+        '--query-timeout',
+        metavar='MS',
+        dest='query_timeout',
+        type=int,
+        default=0,
+        help='give up on a solver query after MS milliseconds (0 = no limit)')
+    PARSER.add_argument(
+        '--query-rlimit',
+        metavar='N',
+        dest='query_rlimit',
+        type=int,
+        default=0,
+        help='give up on a solver query after N z3 resource units (0 = no limit)')
+    PARSER.add_argument(
+        '--memory-limit',
+        metavar='MB',
+        dest='memory_limit',
+        type=int,
+        default=0,
+        help='let z3 use at most MB megabytes (0 = no limit)')
+    PARSER.add_argument(
+        '--result-cache',
+        metavar='DIR',
+        dest='result_cache',
+        default=None,
+        help='keep results in DIR and reuse them for unchanged functions')
+    PARSER.add_argument(
+        '--strip',
+        metavar='<file>',
+        dest='strip',
+        default=None,
+        help='also write the program\'s bitcode to <file>, without the checks Z0 proved')
     PARSER.add_argument(
         'files',
         metavar='SOURCEFILE',
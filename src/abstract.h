@@ -0,0 +1,361 @@
+#pragma once
+
+#include "llvm/ADT/Optional.h"
+#include "z3++.h"
+#include "cache.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+
+Z0_STATISTIC(NumAbstractTried, "Queries tried over the integers first");
+Z0_STATISTIC(NumAbstractProofs, "Queries the integer abstraction proved unsat");
+Z0_STATISTIC(NumAbstractModels, "Integer models that held in 32-bit arithmetic");
+Z0_STATISTIC(NumAbstractSpurious, "Integer models that didn't hold in 32-bit arithmetic");
+Z0_STATISTIC(NumAbstractUnknown, "Queries the integer abstraction couldn't decide");
+
+/* Restates a bit-vector query over the mathematical integers, where
+ * multiplication and division don't have to be bit-blasted.
+ * Each n-bit term becomes the integer it means as a signed number (1-bit
+ * terms, C0's booleans, as unsigned). Operations whose result might not
+ * fit get a fresh value in range wherever it doesn't, instead of the
+ * wrapped one, and operations with no cheap integer counterpart always do.
+ * So the integer query has every model the bit-vector query has (and maybe
+ * more): if it is unsat, so is the bit-vector query. Terms of other sorts
+ * (the heap's region arrays) are kept as they are, and a value read from
+ * one is some value of its width.
+ */
+class IntAbstraction final {
+    z3::context& cxt;
+    std::unordered_map<unsigned int, z3::expr> memo;   // by AST id
+    std::vector<z3::expr> ranges;                      // for symbols and fresh values
+    std::vector<z3::expr> exact;                       // that nothing had to be made up
+    unsigned int fresh_count = 0;
+
+    z3::expr num(int64_t n) {
+        return cxt.int_val(n);
+    }
+    static int64_t lo(unsigned w) { return w == 1 ? 0 : -(int64_t(1) << (w - 1)); }
+    static int64_t hi(unsigned w) { return w == 1 ? 1 : (int64_t(1) << (w - 1)) - 1; }
+    static int64_t span(unsigned w) { return int64_t(1) << w; }
+
+    z3::expr in_range(z3::expr const& x, unsigned w) {
+        return num(lo(w)) <= x && x <= num(hi(w));
+    }
+
+    /* Some w-bit value (any integer if w is too wide to bound) */
+    z3::expr fresh(unsigned w) {
+        std::string name = "abs!" + std::to_string(++fresh_count);
+        z3::expr x = cxt.int_const(name.c_str());
+        if (w <= 62) ranges.push_back(in_range(x, w));
+        return x;
+    }
+
+    z3::expr fresh_bool(void) {
+        return cxt.bool_const(("abs!" + std::to_string(++fresh_count)).c_str());
+    }
+
+    /* Some value of e's sort, or e itself if it isn't a bit-vector or boolean */
+    z3::expr fresh_like(z3::expr const& e) {
+        if (e.is_bool()) return fresh_bool();
+        if (e.is_bv()) return fresh(e.get_sort().bv_size());
+        return e;
+    }
+
+    /* x if it fits in w bits, otherwise some w-bit value */
+    z3::expr fit(z3::expr const& x, unsigned w) {
+        z3::expr fits = in_range(x, w);
+        exact.push_back(fits);
+        return z3::ite(fits, x, fresh(w));
+    }
+
+    /* x + y or x - y wrapped exactly: they can only leave the range once */
+    z3::expr wrap_once(z3::expr const& x, unsigned w) {
+        return z3::ite(x > num(hi(w)), x - num(span(w)),
+                       z3::ite(x < num(lo(w)), x + num(span(w)), x));
+    }
+
+    z3::expr as_signed(z3::expr const& x, unsigned w) {
+        return w == 1 ? -x : x;
+    }
+    z3::expr as_unsigned(z3::expr const& x, unsigned w) {
+        return w == 1 ? x : z3::ite(x < 0, x + num(span(w)), x);
+    }
+    z3::expr abs(z3::expr const& x) {
+        return z3::ite(x >= 0, x, -x);
+    }
+
+    /* C's truncating division, for y != 0 */
+    z3::expr trunc_div(z3::expr const& x, z3::expr const& y) {
+        z3::expr q = z3::to_expr(cxt, Z3_mk_div(cxt, abs(x), abs(y)));
+        return z3::ite((x >= 0) == (y > 0), q, -q);
+    }
+
+    z3::expr bits_of(z3::expr const& x, unsigned k) {
+        // the low k bits of x, as a k-bit value
+        z3::expr m = z3::to_expr(cxt, Z3_mk_mod(cxt, x, num(span(k))));
+        if (k == 1) return m;
+        return z3::ite(m > num(hi(k)), m - num(span(k)), m);
+    }
+
+    z3::expr translate_app(z3::expr const& e) {
+        Z3_decl_kind kind = e.decl().decl_kind();
+        if (!e.is_bool() && !e.is_bv()) return e;
+        if (kind == Z3_OP_SELECT) return fresh_like(e);
+        unsigned n = e.num_args();
+        std::vector<z3::expr> args;
+        for (unsigned i = 0; i < n; ++i) {
+            args.push_back(translate(e.arg(i)));
+        }
+        unsigned w = e.is_bv() ? e.get_sort().bv_size() : 0;
+        unsigned aw = n && e.arg(0).is_bv() ? e.arg(0).get_sort().bv_size() : 0;
+
+        switch (kind) {
+            case Z3_OP_TRUE: case Z3_OP_FALSE:
+                return e;
+            case Z3_OP_AND: {
+                z3::expr_vector v(cxt);
+                for (z3::expr const& a : args) v.push_back(a);
+                return z3::mk_and(v);
+            }
+            case Z3_OP_OR: {
+                z3::expr_vector v(cxt);
+                for (z3::expr const& a : args) v.push_back(a);
+                return z3::mk_or(v);
+            }
+            case Z3_OP_NOT:     return !args[0];
+            case Z3_OP_IMPLIES: return z3::implies(args[0], args[1]);
+            case Z3_OP_IFF:     return args[0] == args[1];
+            case Z3_OP_XOR:     return args[0] != args[1];
+            case Z3_OP_EQ:      return args[0] == args[1];
+            case Z3_OP_DISTINCT: {
+                z3::expr_vector v(cxt);
+                for (z3::expr const& a : args) v.push_back(a);
+                return z3::distinct(v);
+            }
+            case Z3_OP_ITE:     return z3::ite(args[0], args[1], args[2]);
+
+            case Z3_OP_SLEQ: return as_signed(args[0], aw) <= as_signed(args[1], aw);
+            case Z3_OP_SGEQ: return as_signed(args[0], aw) >= as_signed(args[1], aw);
+            case Z3_OP_SLT:  return as_signed(args[0], aw) < as_signed(args[1], aw);
+            case Z3_OP_SGT:  return as_signed(args[0], aw) > as_signed(args[1], aw);
+            case Z3_OP_ULEQ: return as_unsigned(args[0], aw) <= as_unsigned(args[1], aw);
+            case Z3_OP_UGEQ: return as_unsigned(args[0], aw) >= as_unsigned(args[1], aw);
+            case Z3_OP_ULT:  return as_unsigned(args[0], aw) < as_unsigned(args[1], aw);
+            case Z3_OP_UGT:  return as_unsigned(args[0], aw) > as_unsigned(args[1], aw);
+
+            case Z3_OP_UNINTERPRETED:
+                if (n == 0 && e.is_bool()) return e;
+                break;
+            default: break;
+        }
+        if (!w || w > 62) return fresh_like(e);
+        switch (kind) {
+            case Z3_OP_BNUM: {
+                uint64_t v;
+                Z3_get_numeral_uint64(cxt, e, &v);
+                int64_t value = (int64_t) v;
+                if (w > 1 && value > hi(w)) value -= span(w);
+                return num(value);
+            }
+            case Z3_OP_BADD: {
+                z3::expr sum = args[0];
+                for (unsigned i = 1; i < n; ++i) sum = wrap_once(sum + args[i], w);
+                return sum;
+            }
+            case Z3_OP_BSUB: return wrap_once(args[0] - args[1], w);
+            case Z3_OP_BNEG: return wrap_once(-args[0], w);
+            case Z3_OP_BNOT: return w == 1 ? 1 - args[0] : -args[0] - 1;
+            case Z3_OP_BMUL: {
+                z3::expr product = args[0];
+                for (unsigned i = 1; i < n; ++i) product = fit(product * args[i], w);
+                return product;
+            }
+            case Z3_OP_BSDIV: case Z3_OP_BSDIV_I: {
+                if (w == 1) break;
+                // INT_MIN / -1 is the only quotient that doesn't fit, and wraps to INT_MIN
+                z3::expr q = trunc_div(args[0], args[1]);
+                return z3::ite(args[1] == 0, z3::ite(args[0] >= 0, num(-1), num(1)),
+                               z3::ite(q > num(hi(w)), num(lo(w)), q));
+            }
+            case Z3_OP_BSREM: case Z3_OP_BSREM_I: {
+                if (w == 1) break;
+                return z3::ite(args[1] == 0, args[0],
+                               args[0] - args[1] * trunc_div(args[0], args[1]));
+            }
+            case Z3_OP_BAND: case Z3_OP_BOR: case Z3_OP_BXOR: {
+                if (w != 1 || n != 2) break;
+                z3::expr a = args[0] == 1, b = args[1] == 1;
+                z3::expr r = kind == Z3_OP_BAND ? (a && b) : kind == Z3_OP_BOR ? (a || b) : (a != b);
+                return z3::ite(r, num(1), num(0));
+            }
+            case Z3_OP_SIGN_EXT:
+                return aw == 1 ? z3::ite(args[0] == 1, num(-1), num(0)) : args[0];
+            case Z3_OP_ZERO_EXT:
+                return as_unsigned(args[0], aw);
+            case Z3_OP_EXTRACT: {
+                unsigned high = Z3_get_decl_int_parameter(cxt, e.decl(), 0);
+                unsigned low = Z3_get_decl_int_parameter(cxt, e.decl(), 1);
+                if (low != 0) break;
+                return bits_of(args[0], high + 1);
+            }
+            case Z3_OP_UNINTERPRETED:
+                if (n == 0) {
+                    z3::expr x = cxt.constant(e.decl().name(), cxt.int_sort());
+                    ranges.push_back(in_range(x, w));
+                    return x;
+                }
+                break;
+            default:
+                break;
+        }
+        return fresh(w);
+    }
+
+public:
+    explicit IntAbstraction(z3::context& cxt) : cxt(cxt) {}
+
+    z3::expr translate(z3::expr const& e) {
+        unsigned int id = Z3_get_ast_id(cxt, e);
+        auto found = memo.find(id);
+        if (found != memo.end()) return found->second;
+        z3::expr result = e.is_app() ? translate_app(e) : fresh_like(e);
+        memo.emplace(id, result);
+        return result;
+    }
+
+    /* Range constraints on the symbols and fresh values used so far */
+    std::vector<z3::expr> const& side_conditions(void) const { return ranges; }
+
+    /* That every result fit without being made up, in which case a model of
+     * the integer query is one of the bit-vector query too */
+    std::vector<z3::expr> const& no_overflow(void) const { return exact; }
+
+    /* Whether e does arithmetic that's expensive to bit-blast */
+    static bool is_heavy(z3::expr const& e, std::unordered_map<unsigned int, bool>& seen) {
+        if (!e.is_app()) return false;
+        unsigned int id = Z3_get_ast_id(e.ctx(), e);
+        auto found = seen.find(id);
+        if (found != seen.end()) return found->second;
+        bool heavy = false;
+        switch (e.decl().decl_kind()) {
+            case Z3_OP_BMUL: case Z3_OP_BSDIV: case Z3_OP_BSDIV_I:
+            case Z3_OP_BSREM: case Z3_OP_BSREM_I:
+                heavy = true;
+                break;
+            default:
+                for (unsigned i = 0; i < e.num_args() && !heavy; ++i) {
+                    heavy = is_heavy(e.arg(i), seen);
+                }
+        }
+        seen.emplace(id, heavy);
+        return heavy;
+    }
+};
+
+/* Tries arithmetic-heavy queries over the integers before bit-blasting them.
+ * An unsat answer stands as it is. An integer model is turned into a
+ * bit-vector one and only believed if every constraint holds under it in
+ * 32-bit arithmetic. Anything else is left to the exact encoding.
+ */
+class AbstractSolver final {
+    z3::context& cxt;
+
+public:
+    explicit AbstractSolver(z3::context& cxt) : cxt(cxt) {}
+
+    /* The answer to the conjunction of constraints, if the integers settle
+     * it within timeout milliseconds */
+    Optional<CachedResult> check(std::vector<z3::expr> const& constraints, unsigned int timeout) {
+        std::unordered_map<unsigned int, bool> seen;
+        bool heavy = false;
+        for (z3::expr const& c : constraints) {
+            if ((heavy = IntAbstraction::is_heavy(c, seen))) break;
+        }
+        if (!heavy) return None;
+        ++NumAbstractTried;
+
+        IntAbstraction abstraction(cxt);
+        z3::solver solver(cxt);
+        if (timeout) {
+            z3::params params(cxt);
+            params.set("timeout", timeout);
+            solver.set(params);
+        }
+        for (z3::expr const& c : constraints) {
+            solver.add(abstraction.translate(c));
+        }
+        for (z3::expr const& range : abstraction.side_conditions()) {
+            solver.add(range);
+        }
+        switch (solver.check()) {
+            case z3::unsat:
+                ++NumAbstractProofs;
+                return CachedResult{z3::unsat, None};
+            case z3::unknown:
+                ++NumAbstractUnknown;
+                return None;
+            case z3::sat:
+                break;
+        }
+        z3::model model = solver.get_model();
+        if (!abstraction.no_overflow().empty()) {
+            // Look for a model where nothing overflows, which is likelier to hold
+            solver.push();
+            for (z3::expr const& fits : abstraction.no_overflow()) {
+                solver.add(fits);
+            }
+            if (solver.check() == z3::sat) model = solver.get_model();
+            solver.pop();
+        }
+        if (Optional<z3::model> bits = concretize(model, constraints, abstraction)) {
+            ++NumAbstractModels;
+            return CachedResult{z3::sat, bits};
+        }
+        ++NumAbstractSpurious;
+        return None;
+    }
+
+private:
+    /* A bit-vector model with the integer model's values for the query's
+     * symbols, if it satisfies the query */
+    Optional<z3::model> concretize(z3::model const& ints, std::vector<z3::expr> const& constraints,
+                                   IntAbstraction& abstraction) {
+        z3::model bits(cxt, Z3_mk_model(cxt));
+        std::unordered_map<unsigned int, bool> seen;
+        std::vector<z3::expr> todo(constraints.begin(), constraints.end());
+        while (!todo.empty()) {
+            z3::expr e = todo.back();
+            todo.pop_back();
+            if (!e.is_app() || !seen.emplace(Z3_get_ast_id(cxt, e), true).second) continue;
+            if (e.is_const() && e.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+                // regions are left to model completion; the check below decides
+                if (!e.is_bool() && !e.is_bv()) continue;
+                z3::func_decl decl = e.decl();
+                z3::expr value = ints.eval(abstraction.translate(e), true);
+                if (e.is_bool()) {
+                    bits.add_const_interp(decl, value);
+                    continue;
+                }
+                int64_t n;
+                if (!e.is_bv() || !Z3_get_numeral_int64(cxt, value, &n)) return None;
+                unsigned w = e.get_sort().bv_size();
+                uint64_t mask = w >= 64 ? ~uint64_t(0) : (uint64_t(1) << w) - 1;
+                z3::expr bv = cxt.bv_val((uint64_t) n & mask, w);
+                bits.add_const_interp(decl, bv);
+                continue;
+            }
+            for (unsigned i = 0; i < e.num_args(); ++i) {
+                todo.push_back(e.arg(i));
+            }
+        }
+        for (z3::expr const& c : constraints) {
+            if (!bits.eval(c, true).is_true()) return None;
+        }
+        return bits;
+    }
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "llvm/ADT/Optional.h"
+#include "z3++.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+
+Z0_STATISTIC(NumCacheHits, "Solver queries answered by the query cache");
+Z0_STATISTIC(NumCacheMisses, "Solver queries the query cache sent to z3");
+Z0_STATISTIC(NumCacheEvictions, "Query cache entries evicted");
+Z0_STATISTIC(NumCacheUnsatSubsets, "Cache hits on an unsat subset of the query");
+Z0_STATISTIC(NumCacheSatSupersets, "Cache hits on a sat superset of the query");
+Z0_STATISTIC(NumCacheModelHits, "Cache hits by evaluating a stored model");
+
+/* A solver query: the constraints in effect, as z3 AST ids (sorted, without
+ * duplicates) alongside the expressions themselves */
+struct Query final {
+    std::vector<unsigned int> ids;
+    std::vector<z3::expr> constraints;
+
+    /* Fills in ids once the constraints are in place */
+    void seal(z3::context& cxt) {
+        ids.clear();
+        for (z3::expr const& e : constraints) {
+            ids.push_back(Z3_get_ast_id(cxt, e));
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    }
+};
+
+/* What a query (or one subsuming it) came back with */
+struct CachedResult final {
+    z3::check_result result;
+    Optional<z3::model> model; // for sat results
+};
+
+/* Remembers the results of recent queries on one z3::context.
+ * Besides exact repeats, a query is unsat if any cached unsat query is a
+ * subset of it, and sat if any cached sat query is a superset of it or a
+ * cached model happens to satisfy it. Entries keep their expressions alive,
+ * so AST ids can't be recycled under them.
+ */
+class QueryCache final {
+    struct Entry {
+        Query query;
+        CachedResult result;
+        uint64_t last_used;
+    };
+
+    /* How many of the most recent models to try evaluating a query under */
+    static constexpr unsigned models_tried = 8;
+
+    size_t const capacity;
+    std::vector<Entry> entries;
+    std::unordered_map<uint64_t, size_t> by_hash;
+    std::vector<size_t> recent_sat; // newest last
+    uint64_t clock = 0;
+
+    static uint64_t hash(std::vector<unsigned int> const& ids) {
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned int id : ids) {
+            h = (h ^ id) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    static bool subset(std::vector<unsigned int> const& a, std::vector<unsigned int> const& b) {
+        return std::includes(b.begin(), b.end(), a.begin(), a.end());
+    }
+
+    /* Whether model, extended with the definitions the query adds, satisfies
+     * every constraint in the query. Constraints come in path order, so a
+     * symbol is defined (`symbol == value`) before it is used. */
+    static Optional<z3::model> satisfies(z3::model const& model, Query const& query) {
+        z3::context& cxt = model.ctx();
+        z3::model m(cxt, Z3_model_translate(cxt, model, cxt));
+        for (z3::expr const& c : query.constraints) {
+            if (m.eval(c).is_true()) continue;
+            if (!c.is_app() || c.decl().decl_kind() != Z3_OP_EQ) return None;
+            z3::expr symbol = c.arg(0);
+            if (!symbol.is_const() || symbol.decl().decl_kind() != Z3_OP_UNINTERPRETED
+                || Z3_model_has_interp(cxt, m, symbol.decl())) {
+                return None;
+            }
+            z3::func_decl decl = symbol.decl();
+            z3::expr value = m.eval(c.arg(1), true);
+            m.add_const_interp(decl, value);
+        }
+        return m;
+    }
+
+    CachedResult const& hit(Entry& entry) {
+        entry.last_used = ++clock;
+        ++NumCacheHits;
+        return entry.result;
+    }
+
+    void evict(void) {
+        size_t victim = 0;
+        for (size_t i = 1; i < entries.size(); ++i) {
+            if (entries[i].last_used < entries[victim].last_used) victim = i;
+        }
+        ++NumCacheEvictions;
+        by_hash.erase(hash(entries[victim].query.ids));
+        size_t last = entries.size() - 1;
+        if (victim != last) {
+            std::swap(entries[victim], entries[last]);
+            by_hash[hash(entries[victim].query.ids)] = victim;
+        }
+        entries.pop_back();
+        recent_sat.erase(std::remove(recent_sat.begin(), recent_sat.end(), victim), recent_sat.end());
+        std::replace(recent_sat.begin(), recent_sat.end(), last, victim);
+    }
+
+public:
+    explicit QueryCache(size_t capacity) : capacity(capacity) {}
+
+    /* Returns a cached answer to query, if there is one */
+    Optional<CachedResult> lookup(Query const& query) {
+        auto exact = by_hash.find(hash(query.ids));
+        if (exact != by_hash.end() && entries[exact->second].query.ids == query.ids) {
+            return hit(entries[exact->second]);
+        }
+        for (Entry& entry : entries) {
+            if (entry.result.result == z3::unsat && subset(entry.query.ids, query.ids)) {
+                ++NumCacheUnsatSubsets;
+                return hit(entry);
+            }
+            if (entry.result.result == z3::sat && subset(query.ids, entry.query.ids)) {
+                ++NumCacheSatSupersets;
+                return hit(entry);
+            }
+        }
+        for (size_t i = recent_sat.size(); i-- > 0 && recent_sat.size() - i <= models_tried; ) {
+            Entry& entry = entries[recent_sat[i]];
+            if (Optional<z3::model> model = satisfies(*entry.result.model, query)) {
+                ++NumCacheModelHits;
+                hit(entry);
+                CachedResult result{z3::sat, model};
+                insert(query, result); // its children will probably fit the model too
+                return result;
+            }
+        }
+        ++NumCacheMisses;
+        return None;
+    }
+
+    /* Remembers what z3 said about query. Unknown results aren't cached. */
+    void insert(Query query, CachedResult result) {
+        if (result.result == z3::unknown || capacity == 0) return;
+        if (entries.size() >= capacity) evict();
+        uint64_t h = hash(query.ids);
+        by_hash[h] = entries.size();
+        if (result.result == z3::sat) recent_sat.push_back(entries.size());
+        entries.push_back(Entry{std::move(query), std::move(result), ++clock});
+    }
+
+    void clear(void) {
+        entries.clear();
+        by_hash.clear();
+        recent_sat.clear();
+    }
+};
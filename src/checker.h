@@ -0,0 +1,858 @@
+#pragma once
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/Debug.h"
+#include "z3++.h"
+#include "state.h"
+#include "report.h"
+#include "paths.h"
+#include "plan.h"
+#include "worklist.h"
+#include "concrete.h"
+#include "proofs.h"
+#include "stats.h"
+
+#include <string>
+#include <sstream>
+#include <climits>
+#include <cstdint>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace llvm;
+
+
+#define DEBUG_TYPE "Z0"
+
+Z0_STATISTIC(NumCallsSummarized, "Calls checked against their callee's contract");
+
+/* What became of an instruction or block on the path being run */
+enum class Status {
+    Ok,         // keep going
+    Infeasible, // the path can't actually get here
+    Failed,     // found a counterexample; stop checking the function
+    Cut,        // the path went round a loop, which is checked; stop here
+};
+
+/* How exploring (some of) the paths of a function went */
+struct ExploreResult final {
+    bool returns = false; // some path reaches a return
+    bool stopped = false; // gave up early, see Z0Checker::stop_reason
+    unsigned cut = 0;     // paths abandoned at the depth limit
+    /* With -z0-unroll: paths left going round a loop more times than every
+     * path was checked to, and that number of times */
+    unsigned deeper = 0;
+    unsigned unrolled = 0;
+    bool out_of_budget = false; // unrolling ended for want of time or paths
+};
+
+/* A call whose callee's contract is being evaluated, and what has been
+ * worked out about the condition at hand so far */
+struct ContractCall final {
+    CallInst const* call;
+    Summary const* summary;
+    Value const* result; // what the condition calls \result, if anything
+    std::unordered_map<Value const*, Optional<z3::expr>> values;
+    std::map<std::pair<BasicBlock const*, BasicBlock const*>, Optional<z3::expr>> guards;
+    std::unordered_set<BasicBlock const*> visiting;
+};
+
+/* Symbolically checks the contracts of one function at a time.
+ * Paths are explored from an explicit Worklist of PathStates. Infeasible
+ * paths and counterexamples are reported through Status values; StopZ0 is
+ * only thrown for code Z0 can't model.
+ * Each checker owns its own Z0State (and therefore its own z3::context), so
+ * separate checkers can safely run on separate threads.
+ */
+class Z0Checker final {
+
+    Z0State state;
+    z3::expr int_min_expr = state.bv_val(INT32_MIN, I32);
+    z3::expr zero_expr = state.bv_val(0, I32);
+    z3::expr minusone_expr = state.bv_val(-1, I32);
+    z3::expr true_expr = state.bv_val(1, I1);
+    z3::expr false_expr = state.bv_val(0, I1);
+
+    FunctionReport *report = nullptr;
+    ProofLog *proofs = nullptr;
+    FunctionPlan const *plan = nullptr;
+    SearchBudget *budget = nullptr;
+
+    /* The path being run, and who to hand branches off to (if anyone) */
+    PathKey path_key;
+    PathPool *pool = nullptr;
+    unsigned worker = 0;
+
+    /* Where a handed-off path resumes */
+    std::shared_ptr<Frame> resumed;
+
+    /* Checks some path has reached, for the priority search */
+    std::unordered_set<Instruction const*> covered;
+
+    /* Why exploring stopped early */
+    std::string stop_reason;
+
+public:
+    Z0Checker() {}
+
+    /* A checker that resumes a handed-off path on pool thread `worker` */
+    Z0Checker(PathTask& task, FunctionPlan const& plan, SearchBudget& budget,
+              PathPool& pool, unsigned worker, FunctionReport& report, ProofLog& proofs)
+        : state(task.snapshot), report(&report), proofs(&proofs), plan(&plan), budget(&budget),
+          pool(&pool), worker(worker), resumed(std::make_shared<Frame>(nullptr)) {
+        z3::expr_vector const& assertions = *task.snapshot.assertions;
+        for (unsigned i = 0; i < assertions.size(); ++i) {
+            resumed->assertions.push_back(assertions[i]);
+        }
+        task.snapshot.assertions.reset(); // must not outlive our context
+        state.configure(budget.config.solver);
+        state.set_deadline(budget.deadline());
+    }
+
+    /* Checks F, writing everything it would print into report and what it
+     * proves into proofs */
+    void check_function(Function const& F, FunctionPlan const& plan, SearchConfig const& config,
+                        FunctionReport& report, ProofLog& proofs) {
+        SearchBudget budget(config);
+        this->report = &report;
+        this->proofs = &proofs;
+        this->plan = &plan;
+        this->budget = &budget;
+        state.reset();
+        state.configure(config.solver);
+        state.set_deadline(budget.deadline());
+        covered.clear();
+        out() << "Analyzing function " << F.getName().drop_front(4) << "...\n";
+        BasicBlock const& entry = F.getEntryBlock();
+        if (config.concrete_runs && falsify(F, config.concrete_runs, report)) {
+            this->report = nullptr;
+            this->budget = nullptr;
+            return;
+        }
+        try {
+            ExploreResult result = explore(PathState{&entry, nullptr, false, false,
+                                                     std::make_shared<Frame>(nullptr),
+                                                     {}, {}, {}, PathKey(), 0, {}});
+            if (result.stopped) {
+                report_stop(stop_reason, &entry);
+            } else {
+                report_ok(result);
+                if (!result.cut && !result.deeper) proofs.finish();
+            }
+        } catch (StopZ0 e) {
+            report_stop(e.why, &entry);
+        } catch (z3::exception e) {
+            report_internal_error(e);
+        }
+        this->report = nullptr;
+        this->budget = nullptr;
+    }
+
+    /* Checks F like check_function, but explores its paths on `jobs` threads.
+     * Output is the same as check_function's: in particular the counterexample
+     * reported is the first one in DFS order. */
+    static void check_function_parallel(Function const& F, FunctionPlan const& plan,
+                                        SearchConfig const& config, FunctionReport& report,
+                                        ProofLog& proofs, unsigned jobs);
+
+    /* Runs F on `runs` concrete inputs (see ConcreteRunner): every
+     * combination of boundary values first, then random ones. Returns
+     * whether one of them failed a check, having reported it the way a
+     * symbolic counterexample would be. */
+    static bool falsify(Function const& F, unsigned runs, FunctionReport& report);
+
+private: /* Z0-specific logic */
+    raw_ostream& out() { report->set_key(path_key); return report->out(); }
+    raw_ostream& err() { report->set_key(path_key); return report->err(); }
+
+    void report_ok(ExploreResult const& result) {
+        if (result.cut || result.deeper) report->set_bounded();
+        if (result.out_of_budget) report->set_limited();
+        if (result.cut) {
+            out() << "Warning: " << result.cut << " path(s) hit the depth limit and were not checked to the end.\n";
+        }
+        if (result.deeper) {
+            out() << "Verified up to " << result.unrolled << " iteration(s) of each loop; "
+                  << result.deeper << " path(s) go round more.\n";
+        }
+        if (!result.returns && !result.cut && !result.deeper) {
+            out() << "Warning: function never returns. Perhaps an infinite loop or unsatisfiable precondition?\n";
+        }
+        out() << "OK!\n";
+    }
+
+    void report_stop(std::string const& why, BasicBlock const* entry) {
+        DEBUG(dbgs() << "Z0 stopped.\n");
+        err() << "Z0 Stopped: " << why << "\n";
+        report->find(Finding::Stop, why);
+        DEBUG(out() << "Along path: ");
+        DEBUG(state.show_path(out(), entry));
+    }
+
+    void report_internal_error(z3::exception const& e) {
+        err() << "Internal Error! z3 raised an exception:\n";
+        err() << e.msg() << "\n";
+        report->find(Finding::Error, e.msg());
+    }
+
+    /* Explores the paths from a task handed off by another thread */
+    ExploreResult resume(PathTask const& task) {
+        return explore(PathState{task.next, task.from, false, true, std::move(resumed),
+                                 std::move(state.name2val), std::move(state.renamed),
+                                 std::move(state.heap), task.key, task.depth, task.trips});
+    }
+
+    /* Explores every path from root, a block at a time, in the order the
+     * search strategy picks. Limits are enforced here and only here.
+     * Unrolling deepens iteratively: paths about to go round a loop more than
+     * `bound` times wait until every other path is done, then carry on with
+     * the bound doubled. Running out of time or paths after a round is no
+     * failure: every path was still checked up to the last round's bound. */
+    ExploreResult explore(PathState root) {
+        ExploreResult result;
+        Worklist worklist(budget->config.strategy,
+                          [this](PathState const& s) { return distance_to_uncovered(s.block); });
+        std::vector<PathState> deeper;
+        unsigned max_unroll = budget->config.max_unroll;
+        unsigned bound = max_unroll ? 1 : 0;
+        unsigned verified = 0; // bound of the last finished round
+        worklist.push(std::move(root));
+        while (!worklist.empty() || !deeper.empty()) {
+            if (worklist.empty()) {
+                verified = bound;
+                if (bound >= max_unroll) break;
+                bound = std::min(2 * bound, max_unroll);
+                DEBUG(dbgs() << "Unrolling loops up to " << bound << " times\n");
+                for (PathState& s : deeper) {
+                    worklist.push(std::move(s));
+                }
+                deeper.clear();
+            }
+            if (budget->cancelled()) {
+                stop_reason = "Cancelled";
+                result.stopped = true;
+                return result;
+            }
+            if (budget->out_of_time() || budget->out_of_paths()) {
+                if (verified) {
+                    result.deeper = worklist.size() + deeper.size();
+                    result.unrolled = verified;
+                    result.out_of_budget = true;
+                    return result;
+                }
+                stop_reason = budget->out_of_time() ? "Time budget exhausted" : "Path limit reached";
+                result.stopped = true;
+                return result;
+            }
+            PathState s = worklist.pop();
+            path_key = s.key;
+            if (pool && pool->is_after_stop(path_key)) {
+                DEBUG(dbgs() << "Path cancelled: an earlier path stopped Z0\n");
+                continue;
+            }
+            if (budget->too_deep(s.depth)) {
+                DEBUG(dbgs() << "Path cut at depth " << s.depth << "\n");
+                ++result.cut;
+                budget->finish_path();
+                continue;
+            }
+            if (past_bound(s, bound)) {
+                deeper.push_back(std::move(s));
+                continue;
+            }
+            state.activate(s.frame);
+            state.name2val = std::move(s.name2val);
+            state.renamed = std::move(s.renamed);
+            state.heap = std::move(s.heap);
+            if (s.needs_check && !is_reachable()) {
+                budget->finish_path();
+                continue;
+            }
+            bool returns = false;
+            switch (analyze_basicblock(s, worklist, returns)) {
+                case Status::Ok:
+                    if (returns) {
+                        result.returns = true;
+                        budget->finish_path();
+                    }
+                    break;
+                case Status::Infeasible:
+                case Status::Cut:
+                    budget->finish_path();
+                    break;
+                case Status::Failed:
+                    result.stopped = true;
+                    return result;
+            }
+        }
+        if (!deeper.empty()) {
+            result.deeper = deeper.size();
+            result.unrolled = verified;
+        }
+        return result;
+    }
+
+    /* With unrolling, whether s is about to go round a loop more than bound
+     * times */
+    bool past_bound(PathState const& s, unsigned bound) const {
+        if (!bound || !s.from || s.phis_done) return false;
+        auto loop = plan->loops.find(s.block);
+        if (loop == plan->loops.end() || loop->second.invariant
+            || !loop->second.latches.count(s.from)) {
+            return false;
+        }
+        unsigned const* trips = s.trips.lookup(s.block);
+        return (trips ? *trips : 0) + 1 >= bound;
+    }
+
+    /* For the priority search: how many blocks block is from the nearest
+     * check no path has reached yet */
+    unsigned distance_to_uncovered(BasicBlock const* block) {
+        auto ahead = plan->checks_ahead.find(block);
+        if (ahead == plan->checks_ahead.end()) return UINT_MAX;
+        for (auto const& check : ahead->second) {
+            if (!covered.count(check.first)) return check.second;
+        }
+        return UINT_MAX;
+    }
+
+    template <typename T>
+    std::string to_string(T e) {
+        std::stringstream ss;
+        ss << e;
+        return ss.str();
+    }
+
+    bool is_reachable(void) {
+        switch (state.check()) {
+            case z3::unknown:
+                DEBUG(errs() << "***Path could not be confirmed reachable (" << state.reason_unknown()
+                             << "), assuming it is***\n");
+                report->set_limited();
+            case z3::sat:
+                return true;
+            case z3::unsat:
+                DEBUG(dbgs() << "is_reachable is false:\n");
+                DEBUG(dbgs() << to_string(state.solver.assertions()));
+                DEBUG(dbgs() << "\nalong path:\n");
+                DEBUG(state.show_path(dbgs(), nullptr));
+                return false;
+        }
+        __builtin_unreachable();
+    }
+
+    /* Runs s's block on the active path and queues the paths leaving it.
+     * Sets `returns` if the path returns from the function. */
+    Status analyze_basicblock(PathState& s, Worklist& worklist, bool& returns) {
+        BasicBlock const& BB = *s.block;
+        DEBUG(dbgs() << "Analyzing Basic Block " << BB.getName());
+        if (s.from == nullptr) {
+            DEBUG(dbgs() << " (entry block):\n");
+            assume_arguments(*BB.getParent());
+        } else {
+            DEBUG(dbgs() << " (from " << s.from->getName() << "):\n");
+        }
+        // DEBUG(BB->dump());
+        s.frame->blocks.push_back(&BB);
+        auto loop = plan->loops.find(&BB);
+        if (s.from != nullptr && !s.phis_done && loop != plan->loops.end()) {
+            Status status = budget->config.max_unroll && !loop->second.invariant
+                          ? unroll_loop(s, loop->second) : cut_loop(s, loop->second);
+            if (status != Status::Ok) return status;
+        } else if (s.from != nullptr && !s.phis_done) {
+            BasicBlock::const_iterator it = BB.begin();
+            auto nonPhi = BB.getFirstNonPHI();
+            while (&*it != nonPhi) {
+                PHINode const* phi = cast<PHINode>(&*it);
+                Value const* phiVal = phi->getIncomingValueForBlock(s.from);
+                state.assert_eq(state.z3_repr(phi), state.z3_repr(phiVal));
+                ++it;
+            }
+        }
+        TerminatorInst const* term = BB.getTerminator();
+        for (auto it = BB.getFirstNonPHI()->getIterator(); &*it != term; ++it) {
+            Status status = analyze_instruction(&*it);
+            if (status != Status::Ok) return status;
+        }
+
+        if (term->getOpcode() == Instruction::Ret) {
+            if (!is_reachable()) return Status::Infeasible;
+            returns = true;
+        } else if (BranchInst const* br = dyn_cast<BranchInst>(term)) {
+            // The true branch is the first successor
+            auto merge = plan->merges.find(&BB);
+            if (br->isConditional() && merge != plan->merges.end()) {
+                worklist.push(merge_region(s, merge->second));
+            } else if (br->isConditional()) {
+                z3::expr cond_expr = state.z3_repr(br->getCondition());
+                PathState taken = successor(s, br->getSuccessor(0), 0);
+                PathState not_taken = successor(s, br->getSuccessor(1), 1);
+                taken.frame->assertions.push_back(cond_expr == true_expr);
+                not_taken.frame->assertions.push_back(cond_expr == false_expr);
+                if (pool && pool->hungry()) {
+                    // Let an idle thread take the false branch
+                    hand_off(not_taken);
+                } else {
+                    worklist.push(std::move(not_taken));
+                }
+                worklist.push(std::move(taken));
+            } else { // unconditional branch
+                PathState next = std::move(s);
+                next.from = next.block;
+                next.block = br->getSuccessor(0);
+                next.phis_done = false;
+                next.needs_check = false;
+                next.name2val = std::move(state.name2val);
+                next.renamed = std::move(state.renamed);
+                next.heap = std::move(state.heap);
+                ++next.depth;
+                worklist.push(std::move(next));
+            }
+        } else if (isa<UnreachableInst>(term)) {
+            // If LLVM can detect this is impossible with
+            // its few analyses, then it's probably pretty simple/intended
+            DEBUG(dbgs() << "Assuming trivially unreachable path is intended\n");
+            returns = true;
+        } else {
+            DEBUG(term->dump());
+            throw StopZ0("Unknown basic block terminator");
+        }
+        return Status::Ok;
+    }
+
+    /* The path from s's block to its `direction` successor, in a new frame */
+    PathState successor(PathState const& s, BasicBlock const* next, uint8_t direction) {
+        PathKey key = s.key;
+        key.push_back(direction);
+        return PathState{next, s.block, false, true, std::make_shared<Frame>(s.frame),
+                         state.name2val, state.renamed, state.heap, std::move(key),
+                         s.depth + 1, s.trips};
+    }
+
+    /* What the function's pointer arguments point to existed before it was
+     * called, so it isn't anything the function allocates */
+    void assume_arguments(Function const& F) {
+        for (Argument const& arg : F.args()) {
+            if (arg.getType()->isPointerTy()) {
+                state.add(z3::ult(state.z3_repr(&arg), state.address(0)));
+            }
+        }
+    }
+
+    /* Runs the loop headed by s's block once, from an arbitrary iteration,
+     * instead of once per iteration. Coming from outside the loop, checks
+     * the invariants hold on entry, then havocs everything the loop computes
+     * and every region it (or anything it calls) stores to:
+     * the header then runs as usual, assuming the invariants, and paths leave
+     * the loop from there. Coming along a back edge, havocs again, checks the
+     * iteration just run preserved the invariants, and cuts the path. */
+    Status cut_loop(PathState& s, LoopCut const& loop) {
+        BasicBlock const& header = *s.block;
+        bool back_edge = loop.latches.count(s.from);
+        DEBUG(dbgs() << "Cutting loop at " << header.getName()
+                     << (back_edge ? " (back edge)\n" : " (entry)\n"));
+        enter_header(s, loop, back_edge);
+        Status status = check_invariants(loop);
+        if (status != Status::Ok) return status;
+        if (back_edge) return Status::Cut;
+        havoc(loop);
+        havoc_memory(loop.writes);
+        return Status::Ok;
+    }
+
+    /* Runs a loop without invariants one more time, as if it were unrolled,
+     * counting how many times the path has gone round */
+    Status unroll_loop(PathState& s, LoopCut const& loop) {
+        bool back_edge = loop.latches.count(s.from);
+        unsigned const* trips = s.trips.lookup(s.block);
+        s.trips.set(s.block, back_edge ? (trips ? *trips : 0) + 1 : 0);
+        enter_header(s, loop, back_edge);
+        return Status::Ok;
+    }
+
+    /* Assigns the header's PHIs along the edge from s.from. Along a back
+     * edge, the loop is havocked first, so the PHIs start a new iteration
+     * from the values of the one just run. */
+    void enter_header(PathState const& s, LoopCut const& loop, bool back_edge) {
+        BasicBlock const& header = *s.block;
+        std::vector<z3::expr> incoming; // before havocking, so they're this iteration's
+        auto nonPhi = header.getFirstNonPHI();
+        for (auto it = header.begin(); &*it != nonPhi; ++it) {
+            incoming.push_back(state.z3_repr(cast<PHINode>(&*it)->getIncomingValueForBlock(s.from)));
+        }
+        if (back_edge) havoc(loop);
+        size_t i = 0;
+        for (auto it = header.begin(); &*it != nonPhi; ++it) {
+            state.assert_eq(state.z3_repr(&*it), incoming[i++]);
+        }
+    }
+
+    /* Runs the loop's prefix (its PHIs already assigned) up to its last
+     * invariant, checking the invariants instead of assuming them */
+    Status check_invariants(LoopCut const& loop) {
+        BasicBlock const* from = nullptr;
+        for (BasicBlock const* block : loop.prefix) {
+            auto it = block->begin();
+            auto nonPhi = block->getFirstNonPHI();
+            for (; from && &*it != nonPhi; ++it) {
+                PHINode const* phi = cast<PHINode>(&*it);
+                state.assert_eq(state.z3_repr(phi), state.z3_repr(phi->getIncomingValueForBlock(from)));
+            }
+            TerminatorInst const* term = block->getTerminator();
+            for (it = nonPhi->getIterator(); &*it != term; ++it) {
+                if (&*it == loop.invariants_end) return Status::Ok;
+                Status status = plan->invariants.count(&*it) ? check_assertion(cast<CallInst>(&*it))
+                                                             : analyze_instruction(&*it);
+                if (status != Status::Ok) return status;
+            }
+            from = block;
+        }
+        return Status::Ok;
+    }
+
+    /* Gives everything the loop computes a fresh symbol on the active path */
+    void havoc(LoopCut const& loop) {
+        for (Instruction const* value : loop.values) {
+            state.rename(value);
+        }
+    }
+
+    /* Forgets what the active path knew about the cells of these regions */
+    void havoc_memory(Regions const& writes) {
+        for (auto const& write : writes) {
+            state.havoc_region(write.second);
+        }
+    }
+
+    /* Hands a path that hasn't started yet to the pool */
+    void hand_off(PathState const& s) {
+        DEBUG(dbgs() << "Handing off path to " << s.block->getName() << "\n");
+        std::unique_ptr<PathTask> task(new PathTask{state.snapshot(*s.frame, s.name2val, s.renamed, s.heap),
+                                                    s.block, s.from, s.key, s.depth, s.trips});
+        pool->push(worker, std::move(task));
+    }
+
+    /* Executes the region between s's branch and its join once, instead of
+     * once per path through it. Each block gets a guard saying when it runs;
+     * PHI nodes and source variables that differ between incoming edges
+     * become if-then-else chains over the edge guards.
+     * Returns the merged path, about to run the join. */
+    PathState merge_region(PathState& s, MergeRegion const& region) {
+        BasicBlock const& BB = *s.block;
+        DEBUG(dbgs() << "Merging paths from " << BB.getName() << " to " << region.join->getName() << "\n");
+        std::unordered_map<BasicBlock const*, z3::expr> guards;
+        std::unordered_map<BasicBlock const*, VarMap> locals;
+        guards.emplace(&BB, state.cxt.bool_val(true));
+        locals.emplace(&BB, state.name2val);
+        for (BasicBlock const* block : region.blocks) {
+            enter_merged(*block, guards, locals);
+            s.frame->blocks.push_back(block);
+            TerminatorInst const* term = block->getTerminator();
+            for (auto it = block->getFirstNonPHI()->getIterator(); &*it != term; ++it) {
+                Status status = analyze_instruction(&*it);
+                assert(status == Status::Ok && "merged regions shouldn't contain checks");
+                (void) status;
+            }
+            locals[block] = state.name2val;
+        }
+        enter_merged(*region.join, guards, locals);
+
+        PathState next = std::move(s);
+        next.from = next.block;
+        next.block = region.join;
+        next.phis_done = true;
+        next.needs_check = false;
+        next.name2val = std::move(state.name2val);
+        next.renamed = std::move(state.renamed);
+        next.heap = std::move(state.heap);
+        next.depth += 1 + region.blocks.size();
+        return next;
+    }
+
+    /* The condition under which control goes from `from` to `to` */
+    z3::expr edge_condition(BasicBlock const* from, BasicBlock const* to) {
+        BranchInst const* br = cast<BranchInst>(from->getTerminator());
+        if (!br->isConditional() || br->getSuccessor(0) == br->getSuccessor(1)) {
+            return state.cxt.bool_val(true);
+        }
+        z3::expr cond_expr = state.z3_repr(br->getCondition());
+        return cond_expr == (to == br->getSuccessor(0) ? true_expr : false_expr);
+    }
+
+    /* Computes BB's guard and merges its PHI nodes and variables from its
+     * already-guarded predecessors, leaving the variables in state.name2val */
+    void enter_merged(BasicBlock const& BB,
+                      std::unordered_map<BasicBlock const*, z3::expr>& guards,
+                      std::unordered_map<BasicBlock const*, VarMap>& locals) {
+        std::vector<BasicBlock const*> preds;
+        z3::expr_vector edges(state.cxt);
+        for (BasicBlock const* pred : predecessors(&BB)) {
+            auto guard = guards.find(pred);
+            if (guard == guards.end()) continue; // from outside the region
+            if (std::find(preds.begin(), preds.end(), pred) != preds.end()) continue;
+            preds.push_back(pred);
+            edges.push_back(guard->second && edge_condition(pred, &BB));
+        }
+        assert(!preds.empty() && "merged block has no predecessor in its region");
+
+        z3::expr guard = state.fresh_bool();
+        state.define(guard, z3::mk_or(edges));
+        guards.emplace(&BB, guard);
+
+        BasicBlock::const_iterator it = BB.begin();
+        auto nonPhi = BB.getFirstNonPHI();
+        for (; &*it != nonPhi; ++it) {
+            PHINode const* phi = cast<PHINode>(&*it);
+            z3::expr merged = state.z3_repr(phi->getIncomingValueForBlock(preds.back()));
+            for (size_t i = preds.size() - 1; i-- > 0; ) {
+                z3::expr val = state.z3_repr(phi->getIncomingValueForBlock(preds[i]));
+                merged = z3::ite(edges[i], val, merged);
+            }
+            state.assert_eq(state.z3_repr(phi), merged);
+        }
+
+        VarMap const& first = locals[preds.front()];
+        bool unchanged = true;
+        for (size_t i = 1; i < preds.size(); ++i) {
+            unchanged = unchanged && locals[preds[i]].same_as(first);
+        }
+        if (unchanged) {
+            state.name2val = first;
+            return;
+        }
+        VarMap vars;
+        for (auto const& entry : first) {
+            bool same = true, everywhere = true;
+            for (size_t i = 1; i < preds.size(); ++i) {
+                LocalInfo const* found = locals[preds[i]].lookup(entry.first);
+                if (!found) {
+                    everywhere = false;
+                } else if (*found != entry.second) {
+                    same = false;
+                }
+            }
+            if (!everywhere) continue; // not assigned on every incoming path
+            if (same) {
+                vars.set(entry.first, entry.second);
+            } else if (Optional<LocalInfo> merged = merge_local(entry.first, preds, edges, locals)) {
+                vars.set(entry.first, *merged);
+            }
+        }
+        state.name2val = std::move(vars);
+    }
+
+    /* Merges the values `name` has on each incoming edge into a fresh symbol */
+    Optional<LocalInfo> merge_local(StringRef name, std::vector<BasicBlock const*> const& preds,
+                                    z3::expr_vector const& edges,
+                                    std::unordered_map<BasicBlock const*, VarMap>& locals) {
+        std::vector<z3::expr> vals;
+        for (BasicBlock const* pred : preds) {
+            LocalInfo const& info = *locals[pred].lookup(name);
+            if (info.merged_id) {
+                vals.push_back(state.bv_constant(info.merged_id, info.merged_width));
+            } else if (is_integer_value(info.val->getValue())) {
+                vals.push_back(state.z3_repr(info.val->getValue()));
+            } else {
+                return None; // can't display it anyway
+            }
+        }
+        z3::expr merged = vals.back();
+        for (size_t i = vals.size() - 1; i-- > 0; ) {
+            merged = z3::ite(edges[i], vals[i], merged);
+        }
+        unsigned id = state.fresh_id();
+        unsigned width = merged.get_sort().bv_size();
+        state.define(state.bv_constant(id, width), merged);
+        LocalInfo const& first = *locals[preds.front()].lookup(name);
+        return LocalInfo{first.var, nullptr, id, width};
+    }
+
+    static bool is_integer_value(Value const* v) {
+        return isa<IntegerType>(v->getType())
+            && (isa<ConstantInt>(v) || isa<Instruction>(v) || isa<Argument>(v));
+    }
+
+    Status analyze_instruction(Instruction const* instr) {
+        if (CallInst const* ci = dyn_cast<CallInst>(instr)) {
+            DEBUG(instr->dump());
+            return analyze_call(ci);
+        } else if (isa<PHINode>(instr)) {
+            DEBUG(instr->dump());
+            assert(false && "PHI nodes shouldn't appear in analyze_instruction");
+        } else if (LoadInst const* load = dyn_cast<LoadInst>(instr)) {
+            analyze_load(load);
+        } else if (StoreInst const* store = dyn_cast<StoreInst>(instr)) {
+            analyze_store(store);
+        } else if (isa<GetElementPtrInst>(instr)) {
+            // Field offsets are worked out by the loads and stores using them
+        } else if (instr->getNumOperands() == 2) {
+            analyze_binop(instr);
+        } else if (instr->getNumOperands() == 1) {
+            analyze_unaryop(instr);
+        } else {
+            DEBUG(dbgs() << "Unknown instruction encountered:\n");
+            DEBUG(instr->dump());
+            throw StopZ0("Unknown instruction encountered\n");
+        }
+        return Status::Ok;
+    }
+
+    Status analyze_call(CallInst const* ci) {
+        StringRef name = ci->getCalledFunction()->getName();
+        if (name.startswith("z0")) {
+            return analyze_z0_assert(ci);
+        } else if (name.startswith("_c0_")) {
+            covered.insert(ci);
+            return analyze_c0_call(ci);
+        } else if (name == "c0_idiv") {
+            covered.insert(ci);
+            z3::expr a = state.z3_repr(ci->getOperand(0));
+            z3::expr b = state.z3_repr(ci->getOperand(1));
+            check_div(ci, a, b);
+            state.define_value(ci, binop_expr(Instruction::SDiv, a, b));
+        } else if (name == "c0_imod") {
+            covered.insert(ci);
+            z3::expr a = state.z3_repr(ci->getOperand(0));
+            z3::expr b = state.z3_repr(ci->getOperand(1));
+            check_div(ci, a, b);
+            state.define_value(ci, binop_expr(Instruction::SRem, a, b));
+        } else if (name == "c0_alloc") {
+            state.define_fresh(ci, state.allocate(false));
+        } else if (name == "c0_array_alloc") {
+            covered.insert(ci);
+            z3::expr count = state.z3_repr(ci->getArgOperand(1));
+            check_safe(ci, count < zero_expr, "Negative array size possible!",
+                       "Cannot prove array size nonnegative!");
+            z3::expr array = state.allocate(true);
+            state.add(state.array_length(array) == count);
+            state.define_fresh(ci, array);
+        } else if (name == "c0_deref") {
+            covered.insert(ci);
+            z3::expr object = state.z3_repr(ci->getArgOperand(0));
+            check_safe(ci, object == state.bv_val(0, 64), "Null pointer dereference possible!",
+                       "Cannot prove dereference safe!");
+            state.define_value(ci, object);
+        } else if (name == "c0_array_sub") {
+            // The element's address is worked out by the loads and stores using it
+            covered.insert(ci);
+            check_index(ci, state.z3_repr(ci->getArgOperand(0)), state.z3_repr(ci->getArgOperand(1)));
+        } else if (name == "c0_array_length") {
+            z3::expr array = state.z3_repr(ci->getArgOperand(0));
+            state.add(state.length_facts(array));
+            state.define_value(ci, state.array_length(array));
+        } else if (name == "llvm.dbg.value") {
+            /* This intrinsic provides information when a user source variable
+            is set to a new value.
+            The first argument is the new value (wrapped as metadata).
+            The second argument is the offset in the user source variable
+                where the new value is written.
+            The third argument is a local variable containing a description
+                of the variable.
+            The fourth argument is a complex expression.*/
+            auto const* val_wrap = llvm::cast<MetadataAsValue>(ci->getOperand(0));
+            auto const* lv_wrap = llvm::cast<MetadataAsValue>(ci->getOperand(2));
+            auto const* val = llvm::cast<ValueAsMetadata>(val_wrap->getMetadata());
+            auto const* lv = llvm::cast<DILocalVariable>(lv_wrap->getMetadata());
+            DEBUG(dbgs() << "Got assignment to value: " << lv->getName() << " = " << *val << "\n");
+            if (lv->getName().startswith("_c0v_") || lv->getName() == "_c0t__result") {
+                state.update_ident(lv, val);
+            }
+        } else if (name == "c0_assert") {
+            // Built without COMPILING_FOR_Z0: the z0_* call it asserts is the check
+        } else if (name == "llvm.dbg.declare") {
+            DEBUG(dbgs() << "(Ignoring variable declaration.)\n");
+            /* ignore */
+        } else {
+            throw StopZ0("Unknown function \"" + std::string(name.begin(), name.end()) + "\" called");
+            assert(false);
+        }
+        return Status::Ok;
+    }
+
+    bool is_precondition(CallInst const* ci) {
+        return ci->getCalledFunction()->getName() == "z0_requires";
+    }
+
+    void check_safe(Instruction const* check, z3::expr unsafe, char const* possible,
+                    char const* unproven);
+    void check_div(Instruction const* check, z3::expr a, z3::expr b);
+    void check_index(Instruction const* check, z3::expr array, z3::expr index);
+
+    Status analyze_z0_assert(CallInst const* ci);
+    Status check_assertion(CallInst const* ci);
+    Status check_condition(Instruction const* check, z3::expr cond, std::string const& what);
+
+    Status analyze_c0_call(CallInst const* ci);
+    Optional<z3::expr> contract_value(Value const* v, ContractCall& at);
+    Optional<z3::expr> contract_instruction(Instruction const* instr, ContractCall& at);
+    Optional<z3::expr> contract_edge(BasicBlock const* from, BasicBlock const* to, ContractCall& at);
+    Optional<z3::expr> contract_guard(BasicBlock const* block, BasicBlock const* dom, ContractCall& at);
+
+    void analyze_binop(Instruction const* instr) {
+        assert(instr->getNumOperands() == 2 && "not a binop!");
+        z3::expr a = state.z3_repr(instr->getOperand(0));
+        z3::expr b = state.z3_repr(instr->getOperand(1));
+        try {
+            if (ICmpInst const* icmp = dyn_cast<ICmpInst>(instr)) {
+                z3::expr c = cmp_expr(icmp->getPredicate(), a, b);
+                state.define_value(instr, z3::ite(c, true_expr, false_expr));
+            } else {
+                z3::expr c = binop_expr(instr->getOpcode(), a, b);
+                state.define_value(instr, c);
+            }
+        } catch (StopZ0 e) {
+            DEBUG(instr->dump());
+            throw e;
+        }
+    }
+    /* Reads the cell the load's pointer points to. What it reads depends on
+     * the path's heap, so it gets a fresh symbol every time. */
+    void analyze_load(LoadInst const* load) {
+        Optional<Location> at = locate(load->getPointerOperand(), load->getType());
+        if (!at) {
+            DEBUG(load->dump());
+            throw StopZ0("Unknown kind of load");
+        }
+        state.define_fresh(load, state.load(*at, state.z3_repr(at->object), index_of(*at)));
+    }
+    void analyze_store(StoreInst const* store) {
+        Value const* val = store->getValueOperand();
+        Optional<Location> at = locate(store->getPointerOperand(), val->getType());
+        if (!at) {
+            DEBUG(store->dump());
+            throw StopZ0("Unknown kind of store");
+        }
+        state.store(*at, state.z3_repr(at->object), index_of(*at), state.z3_repr(val));
+    }
+    Optional<z3::expr> index_of(Location const& at) {
+        if (!at.index) return None;
+        return state.z3_repr(at.index);
+    }
+    void analyze_unaryop(Instruction const* instr) {
+        if (isa<BitCastInst>(instr) && instr->getType()->isPointerTy()) {
+            // The same object, seen as another type
+            state.define_value(instr, state.z3_repr(instr->getOperand(0)));
+        } else if (auto const* icast = dyn_cast<CastInst>(instr)) {
+            state.define_value(instr, cast_expr(icast, state.z3_repr(icast->getOperand(0))));
+        } else {
+            DEBUG(instr->dump());
+            throw StopZ0("Unknown unary operator");
+        }
+    }
+
+    /* Helper functions that are big and not very interesting are put into the
+     * .cpp file to help reduce clutter and make the main algorithm more readable
+     */
+    z3::expr cmp_expr(llvm::CmpInst::Predicate pred, z3::expr a, z3::expr b);
+    z3::expr binop_expr(unsigned opcode, z3::expr a, z3::expr b);
+    z3::expr cast_expr(CastInst const* icast, z3::expr operand);
+    void display_counterexample(std::string const& what);
+};
+#undef DEBUG_TYPE
@@ -0,0 +1,336 @@
+#pragma once
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "heap.h"
+#include "stats.h"
+
+#include <climits>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+
+Z0_STATISTIC(NumConcreteRuns, "Functions run on concrete inputs");
+Z0_STATISTIC(NumConcreteFalsified, "Functions falsified by running them");
+
+/* How running a function on one input went */
+enum class RunOutcome {
+    Passed,      // returned with every check holding
+    Rejected,    // the input breaks the function's precondition
+    Failed,      // a check failed: see ConcreteRunner::what
+    Abandoned,   // ran too long, or a callee broke its own contract
+    Unsupported, // ran into something Z0 doesn't model; no input will do
+};
+
+/* Runs C0 functions on concrete inputs, over the same IR (and the same
+ * subset of it) Z0 checks symbolically, with the z0_* calls as checks and
+ * the runtime's as the runtime would run them. A failing check on a real
+ * input is a counterexample no solver is needed for.
+ * Calls to other C0 functions are run too, but only their preconditions
+ * count against the function being run.
+ */
+class ConcreteRunner final {
+    /* Unwinds a run that is over */
+    struct Halt { RunOutcome outcome; };
+    using Frame = std::unordered_map<Value const*, uint64_t>;
+
+    static const unsigned long MaxSteps = 1ul << 16;
+    static const unsigned MaxDepth = 64;
+
+    unsigned long steps = 0;
+    /* Heap cells by region, object and index (0 outside arrays). Cells
+     * never stored to are zero, like fresh allocations. */
+    std::map<std::tuple<std::string, uint64_t, uint64_t>, uint64_t> cells;
+    std::map<uint64_t, uint64_t> lengths;
+    uint64_t allocations = 0;
+    /* The source variables of the function being run, as display_counterexample
+     * would show them */
+    std::map<StringRef, Optional<std::pair<uint64_t, unsigned>>> vars;
+
+public:
+    /* For a failed run: what failed, the message for a failed safety check
+     * (empty for contracts), and the source variables at the time, as
+     * display_counterexample would name and print them */
+    std::string what;
+    std::string message;
+    std::vector<std::pair<std::string, std::string>> shown;
+
+    RunOutcome run(Function const& F, std::vector<uint64_t> const& args) {
+        steps = 0;
+        cells.clear();
+        lengths.clear();
+        allocations = 0;
+        vars.clear();
+        what.clear();
+        message.clear();
+        shown.clear();
+        try {
+            execute(F, args, 0);
+        } catch (Halt halt) {
+            return halt.outcome;
+        }
+        return RunOutcome::Passed;
+    }
+
+    /* The values worth trying for a value `width` bits wide, boundaries
+     * first. Pointers are only ever null: anything else would have to come
+     * from somewhere. */
+    static std::vector<uint64_t> boundaries(unsigned width) {
+        switch (width) {
+            case 1: return {0, 1};
+            case 8: return {0, 1, 127, 255};
+            case 32: return {0, mask(-1, 32), 1, mask(INT32_MIN, 32), INT32_MAX};
+            default: return {0};
+        }
+    }
+
+    /* A random value `width` bits wide, as often small as not */
+    static uint64_t random_value(std::mt19937& rng, unsigned width) {
+        if (width > 32) return 0;
+        if (rng() % 2) return mask((int64_t) (rng() % 33) - 16, width);
+        return mask(rng(), width);
+    }
+
+private:
+    static uint64_t mask(uint64_t v, unsigned width) {
+        return width >= 64 ? v : v & ((uint64_t(1) << width) - 1);
+    }
+    static int64_t sext(uint64_t v, unsigned width) {
+        return width >= 64 ? (int64_t) v : (int64_t) (v << (64 - width)) >> (64 - width);
+    }
+
+    uint64_t eval(Value const* v, Frame const& frame) {
+        if (ConstantInt const* n = dyn_cast<ConstantInt>(v)) {
+            return mask(n->getZExtValue(), n->getBitWidth());
+        }
+        if (isa<ConstantPointerNull>(v)) return 0;
+        auto it = frame.find(v);
+        if (it == frame.end()) throw Halt{RunOutcome::Unsupported}; // undef, globals...
+        return it->second;
+    }
+
+    /* Ends the run at a failed check. Only checks in the function being
+     * run count; a callee's failure is its own business. */
+    [[noreturn]] void fail(unsigned depth, std::string what, std::string message = "") {
+        if (depth > 0) throw Halt{RunOutcome::Abandoned};
+        this->what = std::move(what);
+        this->message = std::move(message);
+        show_vars();
+        throw Halt{RunOutcome::Failed};
+    }
+
+    void show_vars(void) {
+        shown.clear();
+        for (auto const& entry : vars) {
+            std::string name = entry.first == "_c0t__result"
+                             ? "\\result" : entry.first.drop_front(5).str();
+            std::string value;
+            if (!entry.second) {
+                value = "*";
+            } else if (entry.second->second == 32) {
+                value = std::to_string(sext(entry.second->first, 32));
+            } else {
+                value = std::to_string(entry.second->first);
+            }
+            shown.emplace_back(std::move(name), std::move(value));
+        }
+    }
+
+    uint64_t execute(Function const& F, std::vector<uint64_t> const& args, unsigned depth) {
+        if (depth > MaxDepth || F.isDeclaration()) throw Halt{RunOutcome::Abandoned};
+        Frame frame;
+        size_t i = 0;
+        for (Argument const& arg : F.args()) {
+            frame[&arg] = args[i++];
+        }
+        BasicBlock const* block = &F.getEntryBlock();
+        BasicBlock const* from = nullptr;
+        while (true) {
+            // PHIs all read the values from before the edge
+            std::vector<std::pair<Instruction const*, uint64_t>> phis;
+            for (auto it = block->begin(); &*it != block->getFirstNonPHI(); ++it) {
+                PHINode const* phi = cast<PHINode>(&*it);
+                phis.emplace_back(phi, eval(phi->getIncomingValueForBlock(from), frame));
+            }
+            for (auto const& phi : phis) {
+                frame[phi.first] = phi.second;
+            }
+            TerminatorInst const* term = block->getTerminator();
+            for (auto it = block->getFirstNonPHI()->getIterator(); &*it != term; ++it) {
+                if (++steps > MaxSteps) throw Halt{RunOutcome::Abandoned};
+                step(&*it, frame, depth);
+            }
+            from = block;
+            if (ReturnInst const* ret = dyn_cast<ReturnInst>(term)) {
+                return ret->getReturnValue() ? eval(ret->getReturnValue(), frame) : 0;
+            } else if (BranchInst const* br = dyn_cast<BranchInst>(term)) {
+                block = br->isConditional() && !eval(br->getCondition(), frame)
+                      ? br->getSuccessor(1) : br->getSuccessor(0);
+            } else {
+                throw Halt{RunOutcome::Unsupported};
+            }
+        }
+    }
+
+    void step(Instruction const* instr, Frame& frame, unsigned depth) {
+        unsigned width = width_of(instr->getType());
+        if (CallInst const* ci = dyn_cast<CallInst>(instr)) {
+            frame[instr] = call(ci, frame, depth);
+        } else if (ICmpInst const* icmp = dyn_cast<ICmpInst>(instr)) {
+            unsigned w = width_of(icmp->getOperand(0)->getType());
+            int64_t a = sext(eval(icmp->getOperand(0), frame), w);
+            int64_t b = sext(eval(icmp->getOperand(1), frame), w);
+            bool c;
+            switch (icmp->getPredicate()) {
+                case CmpInst::ICMP_EQ:  c = a == b; break;
+                case CmpInst::ICMP_NE:  c = a != b; break;
+                case CmpInst::ICMP_SGT: c = a > b; break;
+                case CmpInst::ICMP_SGE: c = a >= b; break;
+                case CmpInst::ICMP_SLT: c = a < b; break;
+                case CmpInst::ICMP_SLE: c = a <= b; break;
+                default: throw Halt{RunOutcome::Unsupported};
+            }
+            frame[instr] = c;
+        } else if (isa<BinaryOperator>(instr)) {
+            frame[instr] = binop(instr->getOpcode(), eval(instr->getOperand(0), frame),
+                                 eval(instr->getOperand(1), frame), width);
+        } else if (CastInst const* icast = dyn_cast<CastInst>(instr)) {
+            uint64_t a = eval(icast->getOperand(0), frame);
+            switch (icast->getOpcode()) {
+                case Instruction::ZExt:
+                case Instruction::Trunc:   frame[instr] = mask(a, width); break;
+                case Instruction::SExt:    frame[instr] = mask(sext(a, width_of(icast->getSrcTy())), width); break;
+                case Instruction::BitCast: frame[instr] = a; break;
+                default: throw Halt{RunOutcome::Unsupported};
+            }
+        } else if (LoadInst const* load = dyn_cast<LoadInst>(instr)) {
+            auto cell = cells.find(cell_of(load->getPointerOperand(), load->getType(), frame));
+            frame[instr] = cell == cells.end() ? 0 : cell->second;
+        } else if (StoreInst const* store = dyn_cast<StoreInst>(instr)) {
+            Value const* val = store->getValueOperand();
+            cells[cell_of(store->getPointerOperand(), val->getType(), frame)] = eval(val, frame);
+        } else if (isa<GetElementPtrInst>(instr)) {
+            frame[instr] = 0; // worked out by the loads and stores using it
+        } else {
+            throw Halt{RunOutcome::Unsupported};
+        }
+    }
+
+    std::tuple<std::string, uint64_t, uint64_t> cell_of(Value const* ptr, Type const* access, Frame const& frame) {
+        Optional<Location> at = locate(ptr, access);
+        if (!at) throw Halt{RunOutcome::Unsupported};
+        return std::make_tuple(at->region.key, eval(at->object, frame),
+                               at->index ? eval(at->index, frame) : 0);
+    }
+
+    /* Like z3's bit-vector operations, so runs agree with the solver */
+    static uint64_t binop(unsigned opcode, uint64_t a, uint64_t b, unsigned width) {
+        switch (opcode) {
+            case Instruction::Add: return mask(a + b, width);
+            case Instruction::Sub: return mask(a - b, width);
+            case Instruction::Mul: return mask(a * b, width);
+            case Instruction::And: return a & b;
+            case Instruction::Or:  return a | b;
+            case Instruction::Xor: return a ^ b;
+            case Instruction::Shl: return b >= width ? 0 : mask(a << b, width);
+            case Instruction::AShr:
+                return mask(sext(a, width) >> (b >= width ? width - 1 : b), width);
+            case Instruction::SDiv:
+            case Instruction::SRem: {
+                int64_t x = sext(a, width), y = sext(b, width);
+                if (y == 0 || (y == -1 && x == sext(uint64_t(1) << (width - 1), width))) {
+                    throw Halt{RunOutcome::Unsupported}; // C0 divides with c0_idiv
+                }
+                return mask(opcode == Instruction::SDiv ? x / y : x % y, width);
+            }
+            default:
+                throw Halt{RunOutcome::Unsupported};
+        }
+    }
+
+    uint64_t call(CallInst const* ci, Frame& frame, unsigned depth) {
+        StringRef name = callee_name(ci);
+        if (name == "z0_requires") {
+            if (eval(ci->getArgOperand(0), frame)) return 1;
+            if (depth == 0) throw Halt{RunOutcome::Rejected};
+            if (depth > 1) throw Halt{RunOutcome::Abandoned};
+            // The function being run called something without meeting its precondition
+            what = "precondition of " + ci->getFunction()->getName().drop_front(4).str();
+            message.clear();
+            show_vars();
+            throw Halt{RunOutcome::Failed};
+        } else if (name.startswith("z0")) {
+            if (eval(ci->getArgOperand(0), frame)) return 1;
+            fail(depth, name == "z0_ensures" ? "postcondition"
+                      : name == "z0_loop_invariant" ? "loop invariant" : "assertion");
+        } else if (name.startswith("_c0_")) {
+            Function const& callee = *ci->getCalledFunction();
+            std::vector<uint64_t> args;
+            for (unsigned i = 0; i < callee.arg_size(); ++i) {
+                args.push_back(eval(ci->getArgOperand(i), frame));
+            }
+            return execute(callee, args, depth + 1);
+        } else if (name == "c0_idiv" || name == "c0_imod") {
+            int32_t a = (int32_t) eval(ci->getArgOperand(0), frame);
+            int32_t b = (int32_t) eval(ci->getArgOperand(1), frame);
+            if (b == 0 || (a == INT32_MIN && b == -1)) {
+                fail(depth, "safe division", "Division by zero possible!");
+            }
+            return mask(name == "c0_idiv" ? a / b : a % b, 32);
+        } else if (name == "c0_alloc") {
+            return FirstAllocation + ++allocations;
+        } else if (name == "c0_array_alloc") {
+            int32_t count = (int32_t) eval(ci->getArgOperand(1), frame);
+            if (count < 0) fail(depth, "array size", "Negative array size possible!");
+            uint64_t array = FirstAllocation + ++allocations;
+            lengths[array] = count;
+            return array;
+        } else if (name == "c0_deref") {
+            uint64_t object = eval(ci->getArgOperand(0), frame);
+            if (!object) fail(depth, "non-null dereference", "Null pointer dereference possible!");
+            return object;
+        } else if (name == "c0_array_sub") {
+            int32_t index = (int32_t) eval(ci->getArgOperand(1), frame);
+            if (index < 0 || (uint64_t) index >= length(eval(ci->getArgOperand(0), frame))) {
+                fail(depth, "array bounds", "Array index out of bounds possible!");
+            }
+            return 0; // worked out by the loads and stores using it
+        } else if (name == "c0_array_length") {
+            return length(eval(ci->getArgOperand(0), frame));
+        } else if (name == "llvm.dbg.value") {
+            if (depth == 0) track(ci, frame);
+            return 0;
+        } else if (name == "llvm.dbg.declare" || name == "c0_assert") {
+            return 0;
+        }
+        throw Halt{RunOutcome::Unsupported};
+    }
+
+    uint64_t length(uint64_t array) {
+        auto it = lengths.find(array);
+        return it == lengths.end() ? 0 : it->second; // null is empty
+    }
+
+    /* Follows assignments to source variables, like Z0State::update_ident */
+    void track(CallInst const* ci, Frame const& frame) {
+        auto const* val = cast<ValueAsMetadata>(cast<MetadataAsValue>(ci->getOperand(0))->getMetadata());
+        auto const* lv = cast<DILocalVariable>(cast<MetadataAsValue>(ci->getOperand(2))->getMetadata());
+        if (!lv->getName().startswith("_c0v_") && lv->getName() != "_c0t__result") return;
+        Value const* v = val->getValue();
+        unsigned width = width_of(v->getType());
+        Optional<std::pair<uint64_t, unsigned>> value;
+        if (isa<ConstantInt>(v) || isa<ConstantPointerNull>(v) || frame.count(v)) {
+            value = std::make_pair(eval(v, frame), width);
+        }
+        vars[lv->getName()] = value;
+    }
+};
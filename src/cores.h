@@ -0,0 +1,73 @@
+#pragma once
+
+#include "z3++.h"
+#include "cache.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+Z0_STATISTIC(NumCoresLearned, "Unsat cores learned from infeasible paths");
+Z0_STATISTIC(NumCoreConstraints, "Constraints in learned unsat cores");
+Z0_STATISTIC(NumCorePrunes, "Queries found unsat by containing a learned core");
+
+/* Combinations of constraints (mostly branch conditions) that some path
+ * found contradictory. Any later query containing all the constraints of
+ * one of them is unsat too, without asking z3. Cores are usually much
+ * smaller than the paths they came from, so they rule out every sibling
+ * path that repeats the same contradiction.
+ * Like QueryCache entries, cores keep their expressions alive so AST ids
+ * can't be recycled under them.
+ */
+class CoreStore final {
+    size_t const capacity;
+    std::vector<Query> cores; // oldest first
+
+public:
+    explicit CoreStore(size_t capacity) : capacity(capacity) {}
+
+    /* Whether query contains a known contradiction */
+    bool forbids(Query const& query) const {
+        for (Query const& core : cores) {
+            if (std::includes(query.ids.begin(), query.ids.end(),
+                              core.ids.begin(), core.ids.end())) {
+                ++NumCorePrunes;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* Works out which of query's constraints (known to be unsat together)
+     * the contradiction needs, by tracking each with a literal, and
+     * remembers them. Gives up quietly if z3 doesn't come back unsat. */
+    void learn(z3::context& cxt, Query const& query, z3::params const& limits) {
+        if (capacity == 0 || query.constraints.empty()) return;
+        z3::solver tracker(cxt);
+        tracker.set(limits);
+        z3::expr_vector literals(cxt);
+        std::unordered_map<unsigned int, size_t> index_of; // literal AST id -> constraint
+        for (size_t i = 0; i < query.constraints.size(); ++i) {
+            std::string name = "core!" + std::to_string(i);
+            z3::expr literal = cxt.bool_const(name.c_str());
+            tracker.add(z3::implies(literal, query.constraints[i]));
+            literals.push_back(literal);
+            index_of.emplace(Z3_get_ast_id(cxt, literal), i);
+        }
+        if (tracker.check(literals) != z3::unsat) return;
+        z3::expr_vector used = tracker.unsat_core();
+        Query core;
+        for (unsigned i = 0; i < used.size(); ++i) {
+            core.constraints.push_back(query.constraints[index_of.at(Z3_get_ast_id(cxt, used[i]))]);
+        }
+        core.seal(cxt);
+        if (cores.size() >= capacity) cores.erase(cores.begin());
+        ++NumCoresLearned;
+        NumCoreConstraints += core.ids.size();
+        cores.push_back(std::move(core));
+    }
+
+    void clear(void) { cores.clear(); }
+};
@@ -0,0 +1,511 @@
+/* z0: checks C0 programs in one process, as bin/z0.py does with cc0, clang
+ * and two runs of opt. cc0 still runs on its own (it isn't a library), but
+ * clang's frontend, the cleanup passes and Z0 share one LLVMContext and one
+ * PassManager: the module goes from one to the next in memory, and libz3
+ * and the pass are linked in rather than loaded for every file.
+ *
+ * Z0's own options are the -z0-* flags opt takes. With -batch, it checks
+ * every program a manifest or directory lists, several at a time, and
+ * writes what it found as JSON or JUnit XML instead of printing it. With
+ * -serve, it stays up and checks programs for clients of a Unix socket,
+ * remembering results between requests.
+ */
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/CodeGen/CodeGenAction.h"
+#include "clang/Driver/Compilation.h"
+#include "clang/Driver/Driver.h"
+#include "clang/Driver/Tool.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendDiagnostic.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "llvm/Bitcode/BitcodeWriterPass.h"
+#include "llvm/IR/IRPrintingPasses.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar.h"
+#include "passes.h"
+#include "results.h"
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+// Top-level configuration (can change), as in bin/z0.py
+#define CC0_BIN_PREFIX "/home/user/cc0/bin/"
+#define LLVM_BIN_PREFIX "/home/user/llvm-3.9.1.install/bin/"
+#define Z0_PREFIX "/home/user/project/"
+
+static const char* const CC0 = CC0_BIN_PREFIX "cc0.bin";
+/* Where clang's driver would live: it finds its builtin headers from here */
+static const char* const CLANG = LLVM_BIN_PREFIX "clang";
+static const char* const CC0_INCLUDE_PATHS[] = {Z0_PREFIX "include/z0", "/home/user/cc0/runtime/"};
+
+static cl::list<std::string> Files(cl::Positional, cl::ZeroOrMore,
+    cl::desc("<source C0 files>"));
+
+static cl::opt<std::string> Output("o",
+    cl::desc("Place the executable output into <file>"),
+    cl::value_desc("file"),
+    cl::init("a.out"));
+
+static cl::opt<std::string> Strip("strip",
+    cl::desc("Also write the program's bitcode to <file>, without the checks Z0 proved"),
+    cl::value_desc("file"));
+
+static cl::opt<bool> DebugLL("debug-ll",
+    cl::desc("Output the human-readable bitcode Z0 checks (as <last file>.ll)"),
+    cl::init(false));
+
+static cl::opt<std::string> Batch("batch",
+    cl::desc("Check every program a manifest (one program's files per line) or "
+             "directory (each .c0 file on its own) lists"),
+    cl::value_desc("manifest or directory"));
+
+static cl::opt<unsigned> BatchJobs("batch-jobs",
+    cl::desc("Number of programs to check at once in batch mode (0 = one per core)"),
+    cl::init(1));
+
+static cl::opt<std::string> Results("results",
+    cl::desc("Write batch results to <file> (- = stdout)"),
+    cl::value_desc("file"),
+    cl::init("-"));
+
+static cl::opt<std::string> Serve("serve",
+    cl::desc("Check programs for clients of a Unix socket at <path>, until killed"),
+    cl::value_desc("path"));
+
+static cl::opt<unsigned> ServeJobs("serve-jobs",
+    cl::desc("Number of requests to answer at once in server mode (0 = one per core)"),
+    cl::init(0));
+
+enum class ResultsFormat { JSON, JUnit };
+
+static cl::opt<ResultsFormat> Format("results-format",
+    cl::desc("Format of batch (and server) results"),
+    cl::values(
+        clEnumValN(ResultsFormat::JSON, "json", "JSON (default)"),
+        clEnumValN(ResultsFormat::JUnit, "junit", "JUnit XML"),
+        clEnumValEnd),
+    cl::init(ResultsFormat::JSON));
+
+/* Compiles the C0 files to C (and an executable), leaving the C beside the
+ * last of them */
+static bool
+run_cc0(std::vector<std::string> const& files, std::string const& executable, std::string& why) {
+    std::vector<const char*> args{CC0, "-o", executable.c_str(),
+                                  "-L", Z0_PREFIX "include", "-L", Z0_PREFIX "lib",
+                                  "-d", "--no-log", "--save-files", "--standard=c0"};
+    for (std::string const& file : files) {
+        args.push_back(file.c_str());
+    }
+    args.push_back(nullptr);
+    std::string error;
+    int status = sys::ExecuteAndWait(CC0, args.data(), nullptr, nullptr, 0, 0, &error);
+    if (status != 0) {
+        why = "cc0 failed" + (error.empty() ? "" : ": " + error);
+        return false;
+    }
+    return true;
+}
+
+/* Runs clang's frontend on c_file, as `clang -S -emit-llvm` would with
+ * bin/z0.py's options, printing any diagnostics to `diagnostics`. Without
+ * for_z0, the contracts are asserted as they would be in the shipped
+ * program. */
+static std::unique_ptr<Module>
+compile(std::string const& c_file, LLVMContext& context, bool for_z0, raw_ostream& diagnostics) {
+    IntrusiveRefCntPtr<clang::DiagnosticOptions> diag_options = new clang::DiagnosticOptions();
+    clang::TextDiagnosticPrinter* printer = new clang::TextDiagnosticPrinter(diagnostics, &*diag_options);
+    IntrusiveRefCntPtr<clang::DiagnosticIDs> diag_ids(new clang::DiagnosticIDs());
+    clang::DiagnosticsEngine diags(diag_ids, &*diag_options, printer);
+
+    clang::driver::Driver driver(CLANG, sys::getProcessTriple(), diags);
+    driver.setCheckInputsExist(false);
+    SmallVector<const char*, 16> args{CLANG, "-fsyntax-only",
+                                      "-O0", "-std=c99", "-fwrapv", "-w", "-g"};
+    for (const char* path : CC0_INCLUDE_PATHS) {
+        args.push_back("-I");
+        args.push_back(path);
+    }
+    if (for_z0) {
+        args.push_back("-D");
+        args.push_back("COMPILING_FOR_Z0");
+    }
+    args.push_back(c_file.c_str());
+    std::unique_ptr<clang::driver::Compilation> compilation(driver.BuildCompilation(args));
+    if (!compilation) return nullptr;
+
+    // The driver only works out the -cc1 arguments; the job itself runs here
+    clang::driver::JobList const& jobs = compilation->getJobs();
+    if (jobs.size() != 1 || !isa<clang::driver::Command>(*jobs.begin())) {
+        SmallString<256> message;
+        raw_svector_ostream os(message);
+        jobs.Print(os, "; ", true);
+        diags.Report(clang::diag::err_fe_expected_compiler_job) << os.str();
+        return nullptr;
+    }
+    clang::driver::Command const& cc1 = cast<clang::driver::Command>(*jobs.begin());
+    llvm::opt::ArgStringList const& cc1_args = cc1.getArguments();
+    std::unique_ptr<clang::CompilerInvocation> invocation(new clang::CompilerInvocation);
+    clang::CompilerInvocation::CreateFromArgs(*invocation,
+                                              cc1_args.data(),
+                                              cc1_args.data() + cc1_args.size(),
+                                              diags);
+
+    clang::CompilerInstance instance;
+    instance.setInvocation(invocation.release());
+    instance.createDiagnostics(printer, false);
+    if (!instance.hasDiagnostics()) return nullptr;
+    clang::EmitLLVMOnlyAction action(&context);
+    if (!instance.ExecuteAction(action)) return nullptr;
+    return action.takeModule();
+}
+
+/* A directory of its own for cc0's output on one program. cc0 writes the C
+ * for a program beside the last of its files, so checks running at once (in
+ * batch and server modes) would overwrite and delete each other's. Here
+ * cc0 sees the last file through a symlink in a fresh directory, among
+ * symlinks to everything beside it, so its #use "..." lines still resolve.
+ * The directory goes when the Staging does. */
+class Staging final {
+    SmallString<128> dir;
+
+public:
+    std::string last;  // the path to give cc0 for the last file
+    std::string error; // why the directory couldn't be made, if it couldn't
+
+    explicit Staging(std::string const& file) {
+        SmallString<128> source(file);
+        std::error_code ec = sys::fs::make_absolute(source);
+        if (!ec) ec = sys::fs::createUniqueDirectory("z0", dir);
+        if (ec) {
+            error = file + ": " + ec.message();
+            dir.clear();
+            return;
+        }
+        StringRef name = sys::path::filename(source);
+        std::string outputs = (name + ".").str(); // cc0's .c and .h, our .bin
+        StringRef parent = sys::path::parent_path(source);
+        for (sys::fs::directory_iterator it(parent, ec), end; it != end && !ec; it.increment(ec)) {
+            StringRef entry = sys::path::filename(it->path());
+            if (entry.startswith(outputs)) continue;
+            SmallString<128> link(dir);
+            sys::path::append(link, entry);
+            sys::fs::create_link(it->path(), link);
+        }
+        SmallString<128> link(dir);
+        sys::path::append(link, name);
+        last = link.str().str();
+        if (!sys::fs::exists(last)) { // its directory couldn't be listed
+            ec = sys::fs::create_link(source, link);
+            if (ec) error = file + ": " + ec.message();
+        }
+    }
+
+    ~Staging() {
+        if (dir.empty()) return;
+        std::error_code ec;
+        std::vector<std::string> entries;
+        for (sys::fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+            entries.push_back(it->path());
+        }
+        for (std::string const& entry : entries) {
+            sys::fs::remove(entry); // the links themselves, not what they point to
+        }
+        sys::fs::remove(dir);
+    }
+};
+
+static bool
+cancelled(Z0Settings const& settings) {
+    return settings.cancelled && *settings.cancelled;
+}
+
+/* Checks the program made of files: C0 sources, or one file of LLVM IR
+ * (.bc or .ll) as clang compiles cc0's output for Z0. Unless Z0 is to print
+ * its results (in batch and server modes), nothing is printed (bar what
+ * cc0 prints) and the executable is thrown away; otherwise the results are
+ * printed as they come, and -strip and -debug-ll apply. */
+static ProgramResult
+check_program(std::vector<std::string> const& files, Z0Settings const& settings) {
+    auto start = std::chrono::steady_clock::now();
+    bool batch = !settings.print;
+    ProgramResult result;
+    result.name = files.back();
+    result.files = files;
+    std::string ll_file = result.name + ".ll";
+    bool strip = !batch && !Strip.empty();
+    bool debug_ll = !batch && DebugLL;
+
+    LLVMContext context;
+    std::unique_ptr<Module> module;
+    StringRef extension = sys::path::extension(result.name);
+    if (files.size() == 1 && (extension == ".bc" || extension == ".ll")) {
+        SMDiagnostic diagnostic;
+        module = parseIRFile(result.name, diagnostic, context);
+        if (!module) {
+            raw_string_ostream os(result.error);
+            diagnostic.print("z0", os);
+            return result;
+        }
+    } else {
+        std::unique_ptr<Staging> staging;
+        std::vector<std::string> sources(files);
+        if (batch) {
+            staging.reset(new Staging(result.name));
+            if (!staging->error.empty()) {
+                result.error = staging->error;
+                return result;
+            }
+            sources.back() = staging->last;
+        }
+        std::string c_file = sources.back() + ".c";
+        std::string h_file = sources.back() + ".h";
+        std::string executable = batch ? sources.back() + ".bin" : Output.getValue();
+        if (cancelled(settings) || !run_cc0(sources, executable, result.error)) {
+            if (result.error.empty()) result.error = "cancelled";
+            return result;
+        }
+        if (batch) sys::fs::remove(executable);
+        if (cancelled(settings)) {
+            result.error = "cancelled";
+            return result;
+        }
+        std::string diagnostics;
+        raw_string_ostream diagnostics_os(diagnostics);
+        raw_ostream& diagnostics_to = batch ? static_cast<raw_ostream&>(diagnostics_os) : errs();
+        module = compile(c_file, context, !strip, diagnostics_to);
+        if (!debug_ll) sys::fs::remove(c_file);
+        sys::fs::remove(h_file);
+        if (!module) {
+            result.error = "clang failed";
+            if (!diagnostics_os.str().empty()) result.error += ":\n" + diagnostics;
+            return result;
+        }
+    }
+    if (cancelled(settings)) {
+        result.error = "cancelled";
+        return result;
+    }
+
+    std::error_code error;
+    std::unique_ptr<tool_output_file> ll_out;
+    if (debug_ll) {
+        outs() << "Outputting human-readable file " << ll_file << "\n";
+        ll_out.reset(new tool_output_file(ll_file, error, sys::fs::F_Text));
+        if (error) {
+            result.error = ll_file + ": " + error.message();
+            return result;
+        }
+    }
+    std::unique_ptr<tool_output_file> stripped;
+    if (strip) {
+        outs() << "Outputting bitcode without proved checks to " << Strip << "\n";
+        stripped.reset(new tool_output_file(Strip, error, sys::fs::F_None));
+        if (error) {
+            result.error = Strip + ": " + error.message();
+            return result;
+        }
+    }
+
+    // bin/z0.py's OPT_BEFORE_PASSES, once (-loops comes with Z0's requirements)
+    legacy::PassManager passes;
+    passes.add(createPromoteMemoryToRegisterPass());
+    passes.add(createJumpThreadingPass());
+    passes.add(createLoopSimplifyPass());
+    if (ll_out) passes.add(createPrintModulePass(ll_out->os()));
+    ModulePass* z0 = nullptr;
+    if (stripped) {
+        passes.add(createZ0StripPass());
+        passes.add(createBitcodeWriterPass(stripped->os()));
+    } else {
+        z0 = createZ0Pass(settings);
+        passes.add(z0);
+    }
+    passes.run(*module);
+    if (cancelled(settings)) result.error = "cancelled";
+
+    if (ll_out) ll_out->keep();
+    if (stripped) stripped->keep();
+    if (z0) result.functions = z0_results(*z0);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+/* The programs a manifest or directory lists. A manifest has one program
+ * per line: its files, separated by spaces and relative to the manifest,
+ * the one with main last. Blank lines and lines starting with # don't
+ * count. In a directory, each .c0 file is a program of its own. */
+static bool
+list_programs(std::string const& path, std::vector<std::vector<std::string>>& programs) {
+    std::error_code error;
+    if (sys::fs::is_directory(path)) {
+        std::vector<std::string> sources;
+        for (sys::fs::directory_iterator it(path, error), end; it != end && !error; it.increment(error)) {
+            if (sys::path::extension(it->path()) == ".c0") sources.push_back(it->path());
+        }
+        std::sort(sources.begin(), sources.end());
+        for (std::string const& source : sources) {
+            programs.push_back({source});
+        }
+    } else {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> manifest = MemoryBuffer::getFile(path);
+        if (!manifest) {
+            error = manifest.getError();
+        } else {
+            StringRef dir = sys::path::parent_path(path);
+            SmallVector<StringRef, 64> lines;
+            (*manifest)->getBuffer().split(lines, '\n', -1, false);
+            for (StringRef line : lines) {
+                line = line.trim();
+                if (line.empty() || line.startswith("#")) continue;
+                SmallVector<StringRef, 4> names;
+                SplitString(line, names);
+                std::vector<std::string> files;
+                for (StringRef name : names) {
+                    SmallString<128> file(sys::path::is_absolute(name) ? "" : dir);
+                    sys::path::append(file, name);
+                    files.push_back(file.str().str());
+                }
+                programs.push_back(std::move(files));
+            }
+        }
+    }
+    if (error) {
+        errs() << "z0: " << path << ": " << error.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+/* Checks every program -batch lists on -batch-jobs threads and writes the
+ * results. Fails if any program did. */
+static int
+run_batch(void) {
+    std::vector<std::vector<std::string>> programs;
+    if (!list_programs(Batch, programs)) return 1;
+    std::vector<ProgramResult> results(programs.size());
+    std::atomic<size_t> next(0);
+    std::mutex progress_lock;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < programs.size(); i = next++) {
+            Z0Settings settings;
+            settings.print = false;
+            results[i] = check_program(programs[i], settings);
+            std::lock_guard<std::mutex> guard(progress_lock);
+            errs() << results[i].name << ": " << (results[i].failed() ? "FAILED" : "ok") << "\n";
+        }
+    };
+
+    unsigned jobs = BatchJobs ? BatchJobs : std::thread::hardware_concurrency();
+    if (jobs > programs.size()) jobs = programs.size();
+    std::vector<std::thread> threads;
+    for (unsigned j = 1; j < jobs; ++j) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    std::error_code error;
+    tool_output_file out(Results, error, sys::fs::F_Text);
+    if (error) {
+        errs() << "z0: " << Results << ": " << error.message() << "\n";
+        return 1;
+    }
+    if (Format == ResultsFormat::JUnit) {
+        write_junit(out.os(), results);
+    } else {
+        write_json(out.os(), results);
+    }
+    out.keep();
+    for (ProgramResult const& result : results) {
+        if (result.failed()) return 1;
+    }
+    return 0;
+}
+
+/* Answers "<tag> <file>..." with the results of checking the files, as
+ * -batch would write them for a program of its own, -serve-jobs requests
+ * at a time. Files are found from where the server runs, so clients should
+ * send absolute paths. */
+static int
+run_server(void) {
+    Server server([](StringRef request, std::atomic<bool> const& cancelled) {
+        SmallVector<StringRef, 8> words;
+        SplitString(request, words);
+        ProgramResult result;
+        if (words.size() < 2) {
+            result.error = "expected: <tag> <file>...";
+        } else {
+            std::vector<std::string> files;
+            for (size_t i = 1; i < words.size(); ++i) {
+                files.push_back(words[i].str());
+            }
+            Z0Settings settings;
+            settings.print = false;
+            settings.remember = true;
+            settings.cancelled = &cancelled;
+            result = check_program(files, settings);
+        }
+        std::string response;
+        raw_string_ostream os(response);
+        if (Format == ResultsFormat::JUnit) {
+            write_junit(os, {result});
+        } else {
+            write_json(os, {result});
+        }
+        return os.str();
+    }, ServeJobs ? ServeJobs : std::thread::hardware_concurrency());
+    return server.serve(Serve) ? 0 : 1;
+}
+
+int
+main(int argc, char** argv) {
+    llvm_shutdown_obj shutdown;
+    PassRegistry& registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeAnalysis(registry);
+    initializeTransformUtils(registry);
+    initializeScalarOpts(registry);
+    cl::ParseCommandLineOptions(argc, argv, "Static Analysis verification for C0\n");
+
+    if (!Serve.empty()) return run_server();
+    if (!Batch.empty()) return run_batch();
+    if (Files.empty()) {
+        errs() << "z0: no source files (or -batch or -serve) given\n";
+        return 1;
+    }
+    std::vector<std::string> files(Files.begin(), Files.end());
+    ProgramResult result = check_program(files, Z0Settings());
+    if (!result.error.empty()) {
+        errs() << "z0: " << result.error << "\n";
+        return 1;
+    }
+    return 0;
+}
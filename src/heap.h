@@ -0,0 +1,121 @@
+#pragma once
+
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/Support/raw_ostream.h"
+#include "pmap.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+using namespace llvm;
+
+/* A part of the heap that no other part can alias. C0 is type safe, so a
+ * field of some struct type (or of a cell c0_alloc made for a single value)
+ * is only ever accessed as that field, and the elements of arrays of some
+ * type only as elements: each of these is a region of its own, with a z3
+ * array of its own. Queries about one region never mention the others.
+ */
+struct Region final {
+    std::string key; // e.g. "[]i32" for int arrays, "*%struct.list.1:i8*" for a field
+    bool array;      // cells are indexed by array, then index
+    unsigned width;  // bits in each cell
+};
+
+/* Regions by key */
+using Regions = std::map<std::string, Region>;
+
+/* Where a load or store goes: a cell of a region, found from the object
+ * (a pointer from c0_alloc or c0_array_alloc) and, for arrays, the index */
+struct Location final {
+    Region region;
+    Value const* object;
+    Value const* index; // null unless region.array
+};
+
+/* The version of a region a path currently sees, by symbol id */
+struct RegionVersion final {
+    unsigned int id;
+    Region region;
+};
+
+/* Addresses handed out by c0_alloc and c0_array_alloc start here. Whatever
+ * existed before the function was called (what its arguments point to)
+ * lives below, so fresh objects never alias old ones. */
+static const uint64_t FirstAllocation = uint64_t(1) << 40;
+
+/* One path's view of memory. A store makes a new version of the region it
+ * writes; regions the path hasn't written are as they were on entry (bar
+ * the path's own allocations, which start out zero). */
+struct Heap final {
+    PersistentMap<std::string, RegionVersion> versions;
+    /* Objects allocated on the path, by address (less FirstAllocation), and
+     * whether each is an array */
+    PersistentMap<unsigned int, bool> allocated;
+};
+
+/* How many bits a value of type t takes in Z0, or 0 if it has no
+ * representation. Pointers are addresses. */
+static inline unsigned width_of(Type const* t) {
+    if (IntegerType const* it = dyn_cast<IntegerType>(t)) return it->getBitWidth();
+    return t->isPointerTy() ? 64 : 0;
+}
+
+static inline std::string type_name(Type const* t) {
+    std::string name;
+    raw_string_ostream os(name);
+    t->print(os);
+    return os.str();
+}
+
+/* Which runtime function call is, if any */
+static inline StringRef callee_name(CallInst const* call) {
+    Function const* callee = call->getCalledFunction();
+    return callee ? callee->getName() : StringRef();
+}
+
+/* Where an access of type `access` through ptr goes, worked out from how
+ * ptr was computed: casts and struct field offsets on top of c0_deref or
+ * c0_array_sub. None if it isn't something C0 could have compiled to. */
+static inline Optional<Location> locate(Value const* ptr, Type const* access) {
+    unsigned width = width_of(access);
+    if (!width) return None;
+    std::string path; // field offsets, outermost first
+    Value const* p = ptr;
+    while (true) {
+        if (BitCastInst const* cast = dyn_cast<BitCastInst>(p)) {
+            p = cast->getOperand(0);
+        } else if (GEPOperator const* gep = dyn_cast<GEPOperator>(p)) {
+            ConstantInt const* first = dyn_cast<ConstantInt>(*gep->idx_begin());
+            if (!first || !first->isZero()) return None; // pointer arithmetic
+            std::string fields = type_name(gep->getSourceElementType());
+            for (auto i = gep->idx_begin() + 1; i != gep->idx_end(); ++i) {
+                ConstantInt const* field = dyn_cast<ConstantInt>(*i);
+                if (!field) return None;
+                fields += "." + std::to_string(field->getZExtValue());
+            }
+            path = path.empty() ? fields : fields + "/" + path;
+            p = gep->getPointerOperand();
+        } else {
+            break;
+        }
+    }
+    Location at{Region{"", false, width}, p, nullptr};
+    if (CallInst const* ci = dyn_cast<CallInst>(p)) {
+        StringRef name = callee_name(ci);
+        if (name == "c0_deref") {
+            at.object = ci->getArgOperand(0);
+        } else if (name == "c0_array_sub") {
+            at.object = ci->getArgOperand(0);
+            at.index = ci->getArgOperand(1);
+            at.region.array = true;
+        }
+    }
+    at.region.key = (at.region.array ? "[]" : "*") + (path.empty() ? "" : path + ":")
+                  + type_name(access);
+    return at;
+}
@@ -0,0 +1,497 @@
+#pragma once
+
+#include "llvm/ADT/Optional.h"
+#include "z3++.h"
+#include "slice.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace llvm;
+
+Z0_STATISTIC(NumPrepassUnsat, "Checks the interval pre-pass found unsat");
+Z0_STATISTIC(NumPrepassSat, "Checks the interval pre-pass found sat");
+Z0_STATISTIC(NumPrepassUndecided, "Checks the interval pre-pass left to the solver");
+
+/* The values an n-bit term can take, as signed numbers (1-bit terms, C0's
+ * booleans, as unsigned). Terms wider than 32 bits are never narrowed. */
+struct Interval final {
+    int64_t lo, hi;
+
+    static int64_t min_of(unsigned w) { return w == 1 ? 0 : -(int64_t(1) << (w - 1)); }
+    static int64_t max_of(unsigned w) { return w == 1 ? 1 : (int64_t(1) << (w - 1)) - 1; }
+
+    static Interval top(unsigned w) { return Interval{min_of(w), max_of(w)}; }
+    static Interval of(int64_t n) { return Interval{n, n}; }
+
+    bool empty(void) const { return lo > hi; }
+    bool single(void) const { return lo == hi; }
+    bool contains(int64_t n) const { return lo <= n && n <= hi; }
+    bool fits(unsigned w) const { return min_of(w) <= lo && hi <= max_of(w); }
+
+    Interval meet(Interval const& o) const { return Interval{std::max(lo, o.lo), std::min(hi, o.hi)}; }
+    Interval join(Interval const& o) const { return Interval{std::min(lo, o.lo), std::max(hi, o.hi)}; }
+};
+
+/* Three-valued truth, for conditions the intervals may or may not decide */
+enum class Truth { False, True, Unknown };
+
+/* Interval abstract interpretation over one path's constraints.
+ * Facts come from constraints known to hold: symbols' definitions
+ * (`sym == expr`), comparisons of a symbol against a constant, and branch
+ * conditions (`cond == 1` where cond is an if-then-else of a comparison).
+ * Everything is an over-approximation, so a condition evaluating to False
+ * can't hold on any model of the facts.
+ */
+class IntervalDomain final {
+    z3::context& cxt;
+    std::unordered_map<unsigned int, z3::expr> defs;        // symbol -> definition
+    std::unordered_map<unsigned int, Interval> bounds;      // symbol -> refinement
+    std::unordered_map<unsigned int, Interval> memo;        // by AST id
+    /* While tentative, what retract() has to undo: the symbols given
+     * definitions, and each refined symbol's bound before (if it had one) */
+    bool tentative = false;
+    std::vector<unsigned int> new_defs;
+    std::vector<std::pair<unsigned int, Optional<Interval>>> old_bounds;
+
+    static unsigned width(z3::expr const& e) { return e.get_sort().bv_size(); }
+    static unsigned int id(z3::expr const& e) { return Z3_get_ast_id(e.ctx(), e); }
+
+    static bool is_symbol(z3::expr const& e) {
+        return e.is_const() && e.decl().decl_kind() == Z3_OP_UNINTERPRETED;
+    }
+
+    static bool numeral(z3::expr const& e, int64_t& n) {
+        if (!e.is_bv() || e.decl().decl_kind() != Z3_OP_BNUM || width(e) > 32) return false;
+        uint64_t v;
+        Z3_get_numeral_uint64(e.ctx(), e, &v);
+        unsigned w = width(e);
+        n = (int64_t) v;
+        if (w > 1 && n > Interval::max_of(w)) n -= int64_t(1) << w;
+        return true;
+    }
+
+    void refine(z3::expr const& symbol, Interval range) {
+        auto found = bounds.find(id(symbol));
+        if (tentative) {
+            old_bounds.emplace_back(id(symbol), found == bounds.end() ? Optional<Interval>() : found->second);
+        }
+        if (found == bounds.end()) {
+            bounds.emplace(id(symbol), range);
+        } else {
+            found->second = found->second.meet(range);
+        }
+    }
+
+    /* What symbol is defined as, if anything */
+    Optional<z3::expr> definition(z3::expr const& e) {
+        if (!is_symbol(e)) return None;
+        auto def = defs.find(id(e));
+        if (def == defs.end()) return None;
+        return def->second;
+    }
+
+    /* Learns from `a cmp b` holding (or not), for a symbol against a constant */
+    void assume_compare(Z3_decl_kind kind, z3::expr const& a, z3::expr const& b, bool holds) {
+        int64_t n;
+        z3::expr symbol = a;
+        bool flipped = false;
+        if (numeral(b, n) && is_symbol(a)) {
+            symbol = a;
+        } else if (numeral(a, n) && is_symbol(b)) {
+            symbol = b;
+            flipped = true;
+        } else {
+            return;
+        }
+        unsigned w = width(symbol);
+        if (w > 32) return;
+        int64_t lo = Interval::min_of(w), hi = Interval::max_of(w);
+        if (flipped) { // n cmp x  ==  x cmp' n
+            switch (kind) {
+                case Z3_OP_SLT:  kind = Z3_OP_SGT; break;
+                case Z3_OP_SLEQ: kind = Z3_OP_SGEQ; break;
+                case Z3_OP_SGT:  kind = Z3_OP_SLT; break;
+                case Z3_OP_SGEQ: kind = Z3_OP_SLEQ; break;
+                default: break;
+            }
+        }
+        if (!holds) {
+            switch (kind) {
+                case Z3_OP_SLT:  kind = Z3_OP_SGEQ; break;
+                case Z3_OP_SLEQ: kind = Z3_OP_SGT; break;
+                case Z3_OP_SGT:  kind = Z3_OP_SLEQ; break;
+                case Z3_OP_SGEQ: kind = Z3_OP_SLT; break;
+                case Z3_OP_EQ:   return; // x != n doesn't narrow an interval much
+                default: return;
+            }
+        }
+        if (w == 1 && kind != Z3_OP_EQ) return; // signed order on 1 bit is upside down
+        switch (kind) {
+            case Z3_OP_EQ:   refine(symbol, Interval::of(n)); break;
+            case Z3_OP_SLT:  refine(symbol, Interval{lo, n - 1}); break;
+            case Z3_OP_SLEQ: refine(symbol, Interval{lo, n}); break;
+            case Z3_OP_SGT:  refine(symbol, Interval{n + 1, hi}); break;
+            case Z3_OP_SGEQ: refine(symbol, Interval{n, hi}); break;
+            default: break;
+        }
+    }
+
+    /* Learns what it can from c being (or not being) true */
+    void assume(z3::expr const& c, bool holds) {
+        if (!c.is_app()) return;
+        Z3_decl_kind kind = c.decl().decl_kind();
+        switch (kind) {
+            case Z3_OP_NOT:
+                assume(c.arg(0), !holds);
+                return;
+            case Z3_OP_AND:
+                if (holds) for (unsigned i = 0; i < c.num_args(); ++i) assume(c.arg(i), true);
+                return;
+            case Z3_OP_OR:
+                if (!holds) for (unsigned i = 0; i < c.num_args(); ++i) assume(c.arg(i), false);
+                return;
+            case Z3_OP_SLT: case Z3_OP_SLEQ: case Z3_OP_SGT: case Z3_OP_SGEQ:
+                assume_compare(kind, c.arg(0), c.arg(1), holds);
+                return;
+            case Z3_OP_EQ:
+                break;
+            default:
+                return;
+        }
+        z3::expr a = c.arg(0), b = c.arg(1);
+        if (!a.is_bv()) return;
+        int64_t n;
+        if (numeral(a, n)) std::swap(a, b);
+        if (!numeral(b, n)) return;
+        if (is_symbol(a)) assume_compare(Z3_OP_EQ, a, b, holds);
+        // cond == k, where cond is (or is defined as) ite(P, k1, k2)
+        z3::expr chosen = a;
+        if (Optional<z3::expr> def = definition(a)) chosen = *def;
+        if (!chosen.is_app() || chosen.decl().decl_kind() != Z3_OP_ITE) return;
+        int64_t then_n, else_n;
+        if (!numeral(chosen.arg(1), then_n) || !numeral(chosen.arg(2), else_n) || then_n == else_n) return;
+        if (holds && n == then_n) assume(chosen.arg(0), true);
+        if (holds && n == else_n) assume(chosen.arg(0), false);
+        if (!holds && n == then_n && width(a) == 1) assume(chosen.arg(0), false);
+        if (!holds && n == else_n && width(a) == 1) assume(chosen.arg(0), true);
+    }
+
+    Truth compare(Z3_decl_kind kind, Interval x, Interval y) {
+        switch (kind) {
+            case Z3_OP_SLT:
+                if (x.hi < y.lo) return Truth::True;
+                if (x.lo >= y.hi) return Truth::False;
+                return Truth::Unknown;
+            case Z3_OP_SLEQ:
+                if (x.hi <= y.lo) return Truth::True;
+                if (x.lo > y.hi) return Truth::False;
+                return Truth::Unknown;
+            case Z3_OP_SGT:  return compare(Z3_OP_SLT, y, x);
+            case Z3_OP_SGEQ: return compare(Z3_OP_SLEQ, y, x);
+            case Z3_OP_EQ:
+                if (x.single() && y.single() && x.lo == y.lo) return Truth::True;
+                if (x.hi < y.lo || y.hi < x.lo) return Truth::False;
+                return Truth::Unknown;
+            default:
+                return Truth::Unknown;
+        }
+    }
+
+    static Truth negate(Truth t) {
+        return t == Truth::True ? Truth::False : t == Truth::False ? Truth::True : Truth::Unknown;
+    }
+
+    static int64_t trunc_div(int64_t a, int64_t b) { return a / b; } // C++ truncates too
+
+public:
+    explicit IntervalDomain(z3::context& cxt) : cxt(cxt) {}
+
+    /* Takes c as given. Definitions of symbols with none yet are remembered
+     * whole; everything else only narrows intervals. */
+    void add_fact(z3::expr const& c) {
+        memo.clear();
+        if (c.is_app() && c.decl().decl_kind() == Z3_OP_EQ && c.arg(0).is_bv()) {
+            for (unsigned side = 0; side < 2; ++side) {
+                z3::expr s = c.arg(side), e = c.arg(1 - side);
+                int64_t n;
+                if (is_symbol(s) && !numeral(e, n) && !defs.count(id(s))) {
+                    defs.emplace(id(s), e);
+                    if (tentative) new_defs.push_back(id(s));
+                    break;
+                }
+            }
+        }
+        assume(c, true);
+    }
+
+    /* Facts from here on can be taken back with retract() */
+    void begin_tentative(void) {
+        tentative = true;
+    }
+
+    /* Forgets the facts added since begin_tentative() */
+    void retract(void) {
+        for (auto it = old_bounds.rbegin(); it != old_bounds.rend(); ++it) {
+            bounds.erase(it->first);
+            if (it->second) bounds.emplace(it->first, *it->second);
+        }
+        for (unsigned int symbol : new_defs) {
+            defs.erase(symbol);
+        }
+        old_bounds.clear();
+        new_defs.clear();
+        tentative = false;
+        memo.clear();
+    }
+
+    void clear(void) {
+        defs.clear();
+        bounds.clear();
+        memo.clear();
+        old_bounds.clear();
+        new_defs.clear();
+        tentative = false;
+    }
+
+    Interval range(z3::expr const& e) {
+        unsigned w = width(e);
+        if (w > 32) return Interval::top(w);
+        unsigned int key = id(e);
+        auto found = memo.find(key);
+        if (found != memo.end()) return found->second;
+        Interval r = compute(e, w);
+        if (!r.fits(w)) r = Interval::top(w);
+        memo.emplace(key, r);
+        return r;
+    }
+
+    Truth truth(z3::expr const& c) {
+        if (!c.is_app()) return Truth::Unknown;
+        Z3_decl_kind kind = c.decl().decl_kind();
+        switch (kind) {
+            case Z3_OP_TRUE:  return Truth::True;
+            case Z3_OP_FALSE: return Truth::False;
+            case Z3_OP_NOT:   return negate(truth(c.arg(0)));
+            case Z3_OP_AND: {
+                Truth t = Truth::True;
+                for (unsigned i = 0; i < c.num_args(); ++i) {
+                    Truth a = truth(c.arg(i));
+                    if (a == Truth::False) return Truth::False;
+                    if (a == Truth::Unknown) t = Truth::Unknown;
+                }
+                return t;
+            }
+            case Z3_OP_OR: {
+                Truth t = Truth::False;
+                for (unsigned i = 0; i < c.num_args(); ++i) {
+                    Truth a = truth(c.arg(i));
+                    if (a == Truth::True) return Truth::True;
+                    if (a == Truth::Unknown) t = Truth::Unknown;
+                }
+                return t;
+            }
+            case Z3_OP_IMPLIES: {
+                Truth a = truth(c.arg(0)), b = truth(c.arg(1));
+                if (a == Truth::False || b == Truth::True) return Truth::True;
+                if (a == Truth::True && b == Truth::False) return Truth::False;
+                return Truth::Unknown;
+            }
+            case Z3_OP_ITE: {
+                Truth cond = truth(c.arg(0));
+                if (cond != Truth::Unknown) return truth(c.arg(cond == Truth::True ? 1 : 2));
+                Truth a = truth(c.arg(1)), b = truth(c.arg(2));
+                return a == b ? a : Truth::Unknown;
+            }
+            case Z3_OP_DISTINCT:
+                if (c.num_args() != 2 || !c.arg(0).is_bv()) return Truth::Unknown;
+                return negate(compare(Z3_OP_EQ, range(c.arg(0)), range(c.arg(1))));
+            case Z3_OP_EQ:
+                if (c.arg(0).is_bool()) {
+                    Truth a = truth(c.arg(0)), b = truth(c.arg(1));
+                    if (a == Truth::Unknown || b == Truth::Unknown) return Truth::Unknown;
+                    return a == b ? Truth::True : Truth::False;
+                }
+                if (!c.arg(0).is_bv()) return Truth::Unknown;
+                return compare(kind, range(c.arg(0)), range(c.arg(1)));
+            case Z3_OP_SLT: case Z3_OP_SLEQ: case Z3_OP_SGT: case Z3_OP_SGEQ:
+                if (width(c.arg(0)) == 1) return Truth::Unknown;
+                return compare(kind, range(c.arg(0)), range(c.arg(1)));
+            default:
+                return Truth::Unknown;
+        }
+    }
+
+private:
+    Interval compute(z3::expr const& e, unsigned w) {
+        Interval top = Interval::top(w);
+        if (!e.is_app()) return top;
+        int64_t n;
+        if (numeral(e, n)) return Interval::of(n);
+        Z3_decl_kind kind = e.decl().decl_kind();
+        if (kind == Z3_OP_UNINTERPRETED && e.num_args() == 0) {
+            Interval r = top;
+            auto def = defs.find(id(e));
+            if (def != defs.end()) r = range(def->second);
+            auto bound = bounds.find(id(e));
+            if (bound != bounds.end()) r = r.meet(bound->second);
+            return r;
+        }
+        switch (kind) {
+            case Z3_OP_ITE: {
+                Truth cond = truth(e.arg(0));
+                if (cond == Truth::True) return range(e.arg(1));
+                if (cond == Truth::False) return range(e.arg(2));
+                return range(e.arg(1)).join(range(e.arg(2)));
+            }
+            case Z3_OP_BADD: {
+                if (w == 1) return top;
+                Interval r = range(e.arg(0));
+                for (unsigned i = 1; i < e.num_args(); ++i) {
+                    Interval a = range(e.arg(i));
+                    r = Interval{r.lo + a.lo, r.hi + a.hi};
+                    if (!r.fits(w)) return top;
+                }
+                return r;
+            }
+            case Z3_OP_BSUB: {
+                if (w == 1) return top;
+                Interval a = range(e.arg(0)), b = range(e.arg(1));
+                return Interval{a.lo - b.hi, a.hi - b.lo};
+            }
+            case Z3_OP_BNEG: {
+                if (w == 1) return top;
+                Interval a = range(e.arg(0));
+                return Interval{-a.hi, -a.lo};
+            }
+            case Z3_OP_BMUL: {
+                if (w == 1 || e.num_args() != 2) return top;
+                Interval a = range(e.arg(0)), b = range(e.arg(1));
+                int64_t c[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+                return Interval{*std::min_element(c, c + 4), *std::max_element(c, c + 4)};
+            }
+            case Z3_OP_BSDIV: case Z3_OP_BSDIV_I: {
+                if (w == 1) return top;
+                Interval a = range(e.arg(0)), b = range(e.arg(1));
+                if (b.contains(0) || (a.contains(Interval::min_of(w)) && b.contains(-1))) return top;
+                int64_t c[] = {trunc_div(a.lo, b.lo), trunc_div(a.lo, b.hi),
+                               trunc_div(a.hi, b.lo), trunc_div(a.hi, b.hi)};
+                return Interval{*std::min_element(c, c + 4), *std::max_element(c, c + 4)};
+            }
+            case Z3_OP_BSREM: case Z3_OP_BSREM_I: {
+                if (w == 1) return top;
+                Interval a = range(e.arg(0)), b = range(e.arg(1));
+                if (b.contains(0)) return top;
+                int64_t m = std::max(std::abs(b.lo), std::abs(b.hi)) - 1;
+                if (a.lo >= 0) return Interval{0, std::min(a.hi, m)};
+                if (a.hi <= 0) return Interval{std::max(a.lo, -m), 0};
+                return Interval{std::max(a.lo, -m), std::min(a.hi, m)};
+            }
+            case Z3_OP_SIGN_EXT: {
+                z3::expr arg = e.arg(0);
+                Interval a = range(arg);
+                if (width(arg) != 1) return a;
+                return Interval{a.hi == 1 ? -1 : 0, a.lo == 1 ? -1 : 0};
+            }
+            case Z3_OP_ZERO_EXT: {
+                Interval a = range(e.arg(0));
+                if (width(e.arg(0)) == 1 || a.lo >= 0) return a;
+                return top;
+            }
+            case Z3_OP_EXTRACT: {
+                if (Z3_get_decl_int_parameter(cxt, e.decl(), 1) != 0) return top;
+                Interval a = range(e.arg(0));
+                if (w == 1) return a.lo >= 0 && a.hi <= 1 ? a : top;
+                return a.fits(w) ? a : top;
+            }
+            default:
+                return top;
+        }
+    }
+};
+
+/* Decides checks that intervals alone can decide, before any solver runs.
+ * The constraints the path was last found satisfiable with provide the
+ * facts. A new constraint that is False under them can't hold, so the
+ * check is unsat. If every new constraint is True under them, or defines a
+ * symbol nothing mentioned before, the check is sat.
+ * Facts are kept between checks: the owner adds each constraint once, as it
+ * becomes known to hold, and clears them when it moves to another path.
+ */
+class Prepass final {
+    z3::context& cxt;
+    Slicer& slicer;
+    IntervalDomain domain;
+    std::unordered_set<unsigned int> mentioned;
+
+public:
+    Prepass(z3::context& cxt, Slicer& slicer) : cxt(cxt), slicer(slicer), domain(cxt) {}
+
+    void add_fact(z3::expr const& c) {
+        domain.add_fact(c);
+        for (unsigned int var : slicer.variables(c)) mentioned.insert(var);
+    }
+
+    void clear(void) {
+        domain.clear();
+        mentioned.clear();
+    }
+
+    /* Decides the facts plus the fresh constraints, leaving the facts as
+     * they were */
+    Optional<z3::check_result> decide(std::vector<z3::expr> const& fresh) {
+        domain.begin_tentative();
+        std::vector<unsigned int> new_mentions;
+        Optional<z3::check_result> decided = decide_fresh(fresh, new_mentions);
+        domain.retract();
+        for (unsigned int var : new_mentions) {
+            mentioned.erase(var);
+        }
+        if (!decided) {
+            ++NumPrepassUndecided;
+        } else if (*decided == z3::sat) {
+            ++NumPrepassSat;
+        } else {
+            ++NumPrepassUnsat;
+        }
+        return decided;
+    }
+
+private:
+    Optional<z3::check_result> decide_fresh(std::vector<z3::expr> const& fresh,
+                                            std::vector<unsigned int>& new_mentions) {
+        bool all_hold = true;
+        for (z3::expr const& c : fresh) {
+            Truth t = domain.truth(c);
+            if (t == Truth::False) return z3::unsat;
+            if (t == Truth::Unknown && !(all_hold && defines_new_symbol(c, mentioned))) {
+                all_hold = false;
+            }
+            if (t == Truth::True || all_hold) domain.add_fact(c);
+            for (unsigned int var : slicer.variables(c)) {
+                if (mentioned.insert(var).second) new_mentions.push_back(var);
+            }
+        }
+        if (all_hold) return z3::sat;
+        return None;
+    }
+
+    /* Whether c is `sym == expr` for a sym no earlier constraint (nor expr)
+     * mentions, which any model can be extended to satisfy */
+    bool defines_new_symbol(z3::expr const& c, std::unordered_set<unsigned int> const& mentioned) {
+        if (!c.is_app() || c.decl().decl_kind() != Z3_OP_EQ) return false;
+        for (unsigned side = 0; side < 2; ++side) {
+            z3::expr s = c.arg(side);
+            if (!s.is_const() || s.decl().decl_kind() != Z3_OP_UNINTERPRETED) continue;
+            unsigned int sid = Z3_get_ast_id(cxt, s);
+            if (mentioned.count(sid)) continue;
+            std::vector<unsigned int> const& in_value = slicer.variables(c.arg(1 - side));
+            if (std::find(in_value.begin(), in_value.end(), sid) == in_value.end()) return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "llvm/Pass.h"
+#include "report.h"
+
+#include <atomic>
+#include <vector>
+
+/* How a tool running Z0 itself wants it to behave, beyond its options */
+struct Z0Settings final {
+    /* Print results as they come. If not, they are only available from
+     * z0_results once the pass has run. */
+    bool print = true;
+    /* Remember results in memory for later runs in this process, even
+     * without -z0-result-cache */
+    bool remember = false;
+    /* Stop checking once this is set */
+    std::atomic<bool> const* cancelled = nullptr;
+};
+
+/* For tools that run Z0 in a pipeline of their own instead of loading
+ * z0.so into opt (see driver.cpp) */
+llvm::ModulePass* createZ0Pass(Z0Settings const& settings = Z0Settings());
+llvm::ModulePass* createZ0StripPass(void);
+std::vector<FunctionResult> z0_results(llvm::ModulePass const& z0);
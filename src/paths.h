@@ -0,0 +1,134 @@
+#pragma once
+
+#include "llvm/IR/BasicBlock.h"
+#include "state.h"
+#include "report.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace llvm;
+
+/* An unexplored branch successor, handed from one thread to another */
+struct PathTask final {
+    PathSnapshot snapshot;     // path condition up to and including the branch
+    BasicBlock const* next;    // block to explore
+    BasicBlock const* from;    // predecessor, for PHI nodes
+    PathKey key;               // DFS position of `next`
+    unsigned depth;            // blocks run before `next`
+    Trips trips;               // times round each unrolled loop
+};
+
+/* Work-stealing pool of PathTasks for exploring one function.
+ * Each worker pushes and pops its own tasks LIFO (keeping its search
+ * depth-first) and steals FIFO from the others (taking the shallowest, and
+ * so probably the largest, unexplored subtrees).
+ */
+class PathPool final {
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::unique_ptr<PathTask>> tasks;
+    };
+    std::vector<Queue> queues;
+    std::atomic<unsigned> pending{0}; // queued or running
+    std::atomic<unsigned> idle{0};    // waiting in next(); changed under wait_lock
+    std::mutex wait_lock;
+    std::condition_variable wake;     // a task was pushed, or the last one finished
+
+    /* The earliest (in DFS order) path that stopped the analysis */
+    std::atomic<bool> stopped{false};
+    std::mutex stop_lock;
+    PathKey stop_key;
+
+public:
+    explicit PathPool(unsigned jobs) : queues(jobs) {}
+
+    unsigned size(void) const { return queues.size(); }
+
+    /* Whether handing off a branch would keep an otherwise idle thread busy.
+     * Snapshotting costs a fresh context, so we only do it on demand. */
+    bool hungry(void) const {
+        return idle.load(std::memory_order_relaxed) > 0;
+    }
+
+    void push(unsigned worker, std::unique_ptr<PathTask> task) {
+        ++pending;
+        {
+            std::lock_guard<std::mutex> guard(queues[worker].lock);
+            queues[worker].tasks.push_back(std::move(task));
+        }
+        std::lock_guard<std::mutex> guard(wait_lock);
+        if (idle) wake.notify_one();
+    }
+
+    /* Takes a task for worker, sleeping while the queues are empty but other
+     * workers may yet push more. Returns null once every task has finished. */
+    std::unique_ptr<PathTask> next(unsigned worker) {
+        std::unique_ptr<PathTask> task = take(worker);
+        if (task) return task;
+        std::unique_lock<std::mutex> guard(wait_lock);
+        ++idle;
+        while (!(task = take(worker)) && pending != 0) {
+            wake.wait(guard);
+        }
+        --idle;
+        return task;
+    }
+
+    /* Takes a task from worker's own queue, or steals one. May return null
+     * even though tasks are still pending. */
+    std::unique_ptr<PathTask> take(unsigned worker) {
+        std::unique_ptr<PathTask> task;
+        {
+            Queue& mine = queues[worker];
+            std::lock_guard<std::mutex> guard(mine.lock);
+            if (!mine.tasks.empty()) {
+                task = std::move(mine.tasks.back());
+                mine.tasks.pop_back();
+                return task;
+            }
+        }
+        for (unsigned i = 1; i < queues.size(); ++i) {
+            Queue& victim = queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        return task;
+    }
+
+    /* Marks a task taken with next() as finished */
+    void finish(void) {
+        if (--pending == 0) {
+            std::lock_guard<std::mutex> guard(wait_lock);
+            wake.notify_all();
+        }
+    }
+
+    /* Records that the path at `key` stopped the analysis */
+    void stop_at(PathKey const& key) {
+        std::lock_guard<std::mutex> guard(stop_lock);
+        if (!stopped || key < stop_key) {
+            stop_key = key;
+        }
+        stopped = true;
+    }
+
+    /* Whether a serial run would have stopped before reaching `key` */
+    bool is_after_stop(PathKey const& key) {
+        if (!stopped) return false;
+        std::lock_guard<std::mutex> guard(stop_lock);
+        return stop_key < key;
+    }
+
+    PathKey const* get_stop_key(void) const {
+        return stopped ? &stop_key : nullptr;
+    }
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "heap.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+/* The acyclic, single-entry part of the CFG between a conditional branch and
+ * its immediate post-dominator (the join). Z0 can execute it once, with each
+ * block guarded by the condition under which it runs, instead of forking. */
+struct MergeRegion final {
+    BasicBlock const* join;
+    std::vector<BasicBlock const*> blocks; // topological order, without the branch or join
+};
+
+/* A loop Z0 runs once, from an arbitrary iteration, instead of unrolling it.
+ * The invariants at the top of the loop are checked on entry and after each
+ * iteration, and assumed in between. */
+struct LoopCut final {
+    std::unordered_set<BasicBlock const*> latches; // blocks branching back to the header
+    std::vector<BasicBlock const*> prefix;         // header, then blocks it falls straight into
+    Instruction const* invariants_end;             // where the prefix's last invariant ends
+    bool invariant = false;                        // whether there are any invariants to cut at
+    std::vector<Instruction const*> values;        // values the loop (or a subloop) computes
+    Regions writes;                                // regions it (or anything it calls) stores to
+    std::vector<Function const*> callees;          // C0 functions it calls
+};
+
+/* The postconditions cc0 checks on the way to one of a function's returns
+ * (it copies them before each one) */
+struct ReturnSite final {
+    BasicBlock const* block;
+    /* What they call \result (null if void), if the return could be found */
+    Optional<Value const*> result;
+    std::vector<Value const*> ensures;
+};
+
+/* A function's contract, as its callers see it. Conditions are 1-bit values
+ * in the function itself, to be evaluated at each call with the call's
+ * arguments (see Z0Checker::analyze_c0_call). */
+struct Summary final {
+    std::vector<Value const*> requires;
+    /* A call returns through one of these, so its postconditions hold at
+     * one of them */
+    std::vector<ReturnSite> returns;
+    /* Every block's immediate dominator, for evaluating PHI nodes */
+    std::unordered_map<BasicBlock const*, BasicBlock const*> dominators;
+    /* Regions it (or anything it calls) stores to, which calls havoc */
+    Regions writes;
+    std::vector<Function const*> callees;
+};
+
+/* Every checked function's summary, worked out once per module */
+using Summaries = std::unordered_map<Function const*, Summary>;
+
+/* Everything Z0 works out about a function from LLVM's analyses before
+ * checking it. LLVM analyses aren't thread-safe, so this is computed up front
+ * and only read while checking. */
+struct FunctionPlan final {
+    std::unordered_map<BasicBlock const*, MergeRegion> merges; // by branching block
+    std::unordered_map<BasicBlock const*, LoopCut> loops;      // by header
+    /* Invariant calls that cutting a loop checks, so running into them is
+     * an assumption */
+    std::unordered_set<Instruction const*> invariants;
+    /* The contracts of functions it might call */
+    Summaries const* summaries = nullptr;
+
+    /* For -z0-search=priority: the checks reachable from each block and how
+     * many blocks away they are, nearest first */
+    std::unordered_map<BasicBlock const*,
+                       std::vector<std::pair<Instruction const*, unsigned>>> checks_ahead;
+};
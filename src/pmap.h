@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/* An immutable sorted map (a treap) whose copies share structure.
+ * Copying costs O(1) and set() costs O(log n): it copies the nodes on the
+ * path to the key and shares everything else with the old map. Nodes are
+ * never modified once built, so copies can be handed to other threads.
+ */
+template <typename K, typename V, typename Compare = std::less<K>>
+class PersistentMap final {
+    struct Node;
+    using Ptr = std::shared_ptr<Node const>;
+
+    struct Node {
+        std::pair<K, V> entry;
+        uint32_t priority;
+        Ptr left, right;
+    };
+
+    Ptr root;
+    size_t count = 0;
+
+    static Ptr make(std::pair<K, V> const& entry, uint32_t priority, Ptr left, Ptr right) {
+        return std::make_shared<Node const>(Node{entry, priority, std::move(left), std::move(right)});
+    }
+
+    /* Priorities only shape the tree, so they needn't be reproducible */
+    static uint32_t random_priority(void) {
+        static thread_local uint32_t x = 2463534242u;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+
+    static Ptr insert(Ptr const& t, std::pair<K, V> const& entry, uint32_t priority, bool& added) {
+        Compare less;
+        if (!t) {
+            added = true;
+            return make(entry, priority, nullptr, nullptr);
+        }
+        if (less(entry.first, t->entry.first)) {
+            Ptr l = insert(t->left, entry, priority, added);
+            if (l->priority > t->priority) { // rotate right
+                return make(l->entry, l->priority, l->left,
+                            make(t->entry, t->priority, l->right, t->right));
+            }
+            return make(t->entry, t->priority, std::move(l), t->right);
+        }
+        if (less(t->entry.first, entry.first)) {
+            Ptr r = insert(t->right, entry, priority, added);
+            if (r->priority > t->priority) { // rotate left
+                return make(r->entry, r->priority,
+                            make(t->entry, t->priority, t->left, r->left), r->right);
+            }
+            return make(t->entry, t->priority, t->left, std::move(r));
+        }
+        return make(entry, t->priority, t->left, t->right);
+    }
+
+public:
+    /* In-order iterator over (key, value) pairs */
+    class const_iterator final {
+        std::vector<Node const*> stack;
+
+        void descend(Node const* n) {
+            for (; n; n = n->left.get()) stack.push_back(n);
+        }
+
+    public:
+        const_iterator() {}
+        explicit const_iterator(Node const* root) { descend(root); }
+
+        std::pair<K, V> const& operator*() const { return stack.back()->entry; }
+        std::pair<K, V> const* operator->() const { return &stack.back()->entry; }
+
+        const_iterator& operator++() {
+            Node const* n = stack.back();
+            stack.pop_back();
+            descend(n->right.get());
+            return *this;
+        }
+
+        bool operator==(const_iterator const& other) const {
+            return stack.empty() ? other.stack.empty()
+                                 : !other.stack.empty() && stack.back() == other.stack.back();
+        }
+        bool operator!=(const_iterator const& other) const { return !(*this == other); }
+    };
+
+    const_iterator begin() const { return const_iterator(root.get()); }
+    const_iterator end() const { return const_iterator(); }
+
+    size_t size(void) const { return count; }
+    bool empty(void) const { return count == 0; }
+    void clear(void) { root.reset(); count = 0; }
+
+    /* Whether the two maps are the same version (and so certainly equal) */
+    bool same_as(PersistentMap const& other) const { return root == other.root; }
+
+    /* Returns the value for key, or null */
+    V const* lookup(K const& key) const {
+        Compare less;
+        Node const* n = root.get();
+        while (n) {
+            if (less(key, n->entry.first)) {
+                n = n->left.get();
+            } else if (less(n->entry.first, key)) {
+                n = n->right.get();
+            } else {
+                return &n->entry.second;
+            }
+        }
+        return nullptr;
+    }
+
+    void set(K const& key, V const& value) {
+        bool added = false;
+        root = insert(root, std::make_pair(key, value), random_priority(), added);
+        if (added) ++count;
+    }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "llvm/ADT/Optional.h"
+#include "z3++.h"
+#include "cache.h"
+#include "stats.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+Z0_STATISTIC(NumPortfolioQueries, "Queries raced between solver strategies");
+Z0_STATISTIC(NumPortfolioDefaultWins, "Portfolio races won by z3's default solver");
+Z0_STATISTIC(NumPortfolioQFBVWins, "Portfolio races won by z3's QF_BV solver");
+Z0_STATISTIC(NumPortfolioBitBlastWins, "Portfolio races won by the bit-blasting pipeline");
+
+/* Races a few ways of solving the same query, each on a thread and a
+ * z3::context of its own. The first sat or unsat answer wins and the rest
+ * are interrupted. Once a strategy has won a race in the current function,
+ * the others start a little later, so they only burn CPU when the favourite
+ * is having trouble.
+ */
+class Portfolio final {
+public:
+    enum Strategy { Default, QFBV, BitBlast, NumStrategies };
+
+private:
+    /* How long the other strategies let the favourite run on its own */
+    static std::chrono::milliseconds head_start(void) {
+        return std::chrono::milliseconds(20);
+    }
+
+    struct Lane {
+        std::unique_ptr<z3::context> cxt;
+        unsigned wins = 0;
+    };
+
+    /* What one strategy came back with, in its own context */
+    struct Outcome {
+        bool done = false;
+        z3::check_result result = z3::unknown;
+        Optional<z3::model> model;
+        std::string reason;
+    };
+
+    z3::context& home;
+    std::vector<Lane> lanes;
+    std::string reason;
+
+    static z3::solver make_solver(z3::context& cxt, unsigned strategy) {
+        switch (strategy) {
+            case Default:  return z3::solver(cxt);
+            case QFBV:     return z3::solver(cxt, "QF_BV");
+            case BitBlast:
+                return (z3::tactic(cxt, "simplify") & z3::tactic(cxt, "solve-eqs")
+                        & z3::tactic(cxt, "bit-blast") & z3::tactic(cxt, "sat")).mk_solver();
+        }
+        __builtin_unreachable();
+    }
+
+    static Z0Statistic& wins_statistic(unsigned strategy) {
+        switch (strategy) {
+            case Default:  return NumPortfolioDefaultWins;
+            case QFBV:     return NumPortfolioQFBVWins;
+            case BitBlast: return NumPortfolioBitBlastWins;
+        }
+        __builtin_unreachable();
+    }
+
+    /* The strategy that has won the most races in this function, if any */
+    int favourite(void) const {
+        int best = -1;
+        for (unsigned i = 0; i < lanes.size(); ++i) {
+            if (lanes[i].wins && (best < 0 || lanes[i].wins > lanes[best].wins)) best = i;
+        }
+        return best;
+    }
+
+public:
+    explicit Portfolio(z3::context& home) : home(home), lanes(NumStrategies) {
+        reset();
+    }
+
+    /* Forgets the winners and everything translated so far */
+    void reset(void) {
+        for (Lane& lane : lanes) {
+            lane.cxt.reset(new z3::context());
+            lane.wins = 0;
+        }
+    }
+
+    /* Why the last race came back unknown */
+    std::string const& reason_unknown(void) const { return reason; }
+
+    /* Solves the conjunction of constraints (from the home context), giving
+     * up after timeout milliseconds (0 = never). rlimit is passed on to each
+     * strategy. A sat answer comes with a model in the home context. */
+    CachedResult check(std::vector<z3::expr> const& constraints,
+                       unsigned int timeout, unsigned int rlimit) {
+        ++NumPortfolioQueries;
+        reason.clear();
+        unsigned const n = lanes.size();
+        std::vector<std::vector<z3::expr>> translated(n);
+        for (unsigned i = 0; i < n; ++i) {
+            for (z3::expr const& e : constraints) {
+                Z3_ast a = Z3_translate(home, e, *lanes[i].cxt);
+                translated[i].push_back(z3::to_expr(*lanes[i].cxt, a));
+            }
+        }
+
+        std::mutex lock;
+        std::condition_variable changed;
+        std::vector<Outcome> outcomes(n);
+        int winner = -1;
+        bool stop = false;
+        unsigned finished = 0;
+        int const leader = favourite();
+
+        auto run = [&](unsigned i) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                if (leader >= 0 && (int) i != leader) {
+                    changed.wait_for(guard, head_start(), [&] { return stop; });
+                }
+                if (stop) {
+                    outcomes[i].done = true;
+                    ++finished;
+                    changed.notify_all();
+                    return;
+                }
+            }
+            Outcome outcome;
+            outcome.done = true;
+            try {
+                z3::context& cxt = *lanes[i].cxt;
+                z3::solver solver = make_solver(cxt, i);
+                if (rlimit) {
+                    z3::params params(cxt);
+                    params.set("rlimit", rlimit);
+                    solver.set(params);
+                }
+                for (z3::expr const& e : translated[i]) {
+                    solver.add(e);
+                }
+                outcome.result = solver.check();
+                if (outcome.result == z3::sat) outcome.model = solver.get_model();
+                if (outcome.result == z3::unknown) outcome.reason = solver.reason_unknown();
+            } catch (z3::exception const& e) {
+                outcome.result = z3::unknown;
+                outcome.reason = e.msg();
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            outcomes[i] = std::move(outcome);
+            if (outcomes[i].result != z3::unknown && winner < 0) {
+                winner = i;
+                stop = true;
+            }
+            ++finished;
+            changed.notify_all();
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < n; ++i) {
+            threads.emplace_back(run, i);
+        }
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            auto settled = [&] { return winner >= 0 || finished == n; };
+            if (timeout) {
+                changed.wait_for(guard, std::chrono::milliseconds(timeout), settled);
+            } else {
+                changed.wait(guard, settled);
+            }
+            stop = true;
+            changed.notify_all();
+            /* An interrupt that lands before a check starts is forgotten, so
+             * keep interrupting until every strategy has given up */
+            while (finished < n) {
+                for (unsigned i = 0; i < n; ++i) {
+                    if (!outcomes[i].done) lanes[i].cxt->interrupt();
+                }
+                changed.wait_for(guard, std::chrono::milliseconds(1));
+            }
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+
+        if (winner < 0) {
+            reason = "timeout";
+            for (Outcome const& outcome : outcomes) {
+                if (!outcome.reason.empty() && outcome.reason != "canceled"
+                    && outcome.reason != "interrupted") {
+                    reason = outcome.reason;
+                    break;
+                }
+            }
+            return CachedResult{z3::unknown, None};
+        }
+        ++lanes[winner].wins;
+        ++wins_statistic(winner);
+        Outcome& won = outcomes[winner];
+        CachedResult result{won.result, None};
+        if (won.model) {
+            result.model = z3::model(home, Z3_model_translate(*lanes[winner].cxt, *won.model, home));
+        }
+        return result;
+    }
+};
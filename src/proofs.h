@@ -0,0 +1,47 @@
+#pragma once
+
+#include "llvm/IR/Instruction.h"
+
+#include <mutex>
+#include <unordered_set>
+
+using namespace llvm;
+
+/* Which of a function's checks Z0 proved, for -z0-strip. A check is proved
+ * if every path through the function was explored to the end and each one
+ * reaching the check found it holds; a check no path reaches can't fail.
+ * Shared by every thread exploring the function.
+ */
+class ProofLog final {
+    mutable std::mutex lock;
+    std::unordered_set<Instruction const*> refuted;
+    bool complete = false;
+
+public:
+    /* Records that check may fail (or might: z3 didn't know) on some path */
+    void refute(Instruction const* check) {
+        std::lock_guard<std::mutex> guard(lock);
+        refuted.insert(check);
+    }
+
+    /* Records that every path through the function was explored */
+    void finish(void) {
+        std::lock_guard<std::mutex> guard(lock);
+        complete = true;
+    }
+
+    bool finished(void) const {
+        std::lock_guard<std::mutex> guard(lock);
+        return complete;
+    }
+
+    bool refuted_at(Instruction const* check) const {
+        std::lock_guard<std::mutex> guard(lock);
+        return refuted.count(check);
+    }
+
+    bool proved(Instruction const* check) const {
+        std::lock_guard<std::mutex> guard(lock);
+        return complete && !refuted.count(check);
+    }
+};
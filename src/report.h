@@ -0,0 +1,190 @@
+#pragma once
+
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+
+using namespace llvm;
+
+/* A position in the depth-first exploration of a function: the sequence of
+ * branch directions taken (0 = true successor, 1 = false successor).
+ * Comparing keys lexicographically gives serial DFS order. */
+using PathKey = std::vector<uint8_t>;
+
+/* Something Z0 found while checking a function that a person would read in
+ * its output, kept for machine-readable results as well */
+struct Finding final {
+    enum Kind { Counterexample, Unknown, Stop, Error } kind;
+    PathKey key;
+    std::string what; // what failed or couldn't be decided, or why checking stopped
+    /* For counterexamples: each source variable ("\\result" for the result)
+     * and its value as printed, "*" if it could be anything */
+    std::vector<std::pair<std::string, std::string>> values;
+};
+
+/* What checking a function came to, worst first */
+enum class Verdict { Error, Failed, Stopped, Unknown, Bounded, Verified };
+
+static inline char const* verdict_name(Verdict verdict) {
+    switch (verdict) {
+        case Verdict::Error: return "error";
+        case Verdict::Failed: return "failed";
+        case Verdict::Stopped: return "stopped";
+        case Verdict::Unknown: return "unknown";
+        case Verdict::Bounded: return "bounded";
+        case Verdict::Verified: return "verified";
+    }
+    return "?";
+}
+
+/* A function's results without its printed output */
+struct FunctionResult final {
+    std::string name;
+    Verdict verdict;
+    std::vector<Finding> findings; // in serial DFS order
+    double seconds;
+    bool cached;                   // from the result cache, not checked this time
+};
+
+/* Everything Z0 prints while checking one function.
+ * Output is buffered per function so functions checked on different threads
+ * can still be printed in module order, exactly as a serial run would.
+ * Output is also tagged with the path it came from, so that paths explored on
+ * different threads can be put back into serial DFS order.
+ */
+class FunctionReport final {
+    friend class ResultStore; // saves and restores the output and findings
+
+    /* An unbuffered raw_ostream that appends to the owning report */
+    class ChunkStream final : public raw_ostream {
+        FunctionReport& report;
+        bool const is_err;
+
+        void write_impl(const char *ptr, size_t size) override {
+            report.append(is_err, ptr, size);
+        }
+        uint64_t current_pos() const override {
+            return report.written;
+        }
+    public:
+        ChunkStream(FunctionReport& report, bool is_err)
+            : raw_ostream(true), report(report), is_err(is_err) {}
+    };
+
+    struct Chunk {
+        bool is_err;
+        PathKey key;
+        std::string text;
+    };
+
+    /* Output in the order it was written */
+    std::vector<Chunk> chunks;
+    std::vector<Finding> findings;
+    bool bounded = false;
+    bool limited = false;
+    PathKey key;
+    uint64_t written = 0;
+    ChunkStream out_stream{*this, false};
+    ChunkStream err_stream{*this, true};
+
+    void append(bool is_err, const char *ptr, size_t size) {
+        if (chunks.empty() || chunks.back().is_err != is_err || chunks.back().key != key) {
+            chunks.push_back(Chunk{is_err, key, std::string()});
+        }
+        chunks.back().text.append(ptr, size);
+        written += size;
+    }
+
+public:
+    /* The function's source name, how long checking it took, and whether
+     * the results came from the result cache instead */
+    std::string name;
+    double seconds = 0;
+    bool cached = false;
+
+    FunctionReport() {}
+    FunctionReport(FunctionReport const&) = delete;
+    FunctionReport& operator=(FunctionReport const&) = delete;
+
+    raw_ostream& out() { return out_stream; }
+    raw_ostream& err() { return err_stream; }
+
+    /* Tags what is written next with the DFS position it was written from */
+    void set_key(PathKey const& k) {
+        if (k != key) key = k;
+    }
+
+    /* Records a finding from the current DFS position, for the caller to
+     * fill in the values of a counterexample */
+    Finding& find(Finding::Kind kind, std::string what) {
+        findings.push_back(Finding{kind, key, std::move(what), {}});
+        return findings.back();
+    }
+
+    /* Records that checking finished without following every path to the end */
+    void set_bounded(void) { bounded = true; }
+
+    /* Records that a time or resource limit shaped the result: a query gave
+     * up, or a budget ended the search. Such results depend on the machine
+     * and its load, so they aren't worth remembering. */
+    void set_limited(void) { limited = true; }
+
+    /* Moves all of other's output into this report */
+    void absorb(FunctionReport& other) {
+        for (Chunk& chunk : other.chunks) {
+            chunks.push_back(std::move(chunk));
+        }
+        other.chunks.clear();
+        for (Finding& finding : other.findings) {
+            findings.push_back(std::move(finding));
+        }
+        other.findings.clear();
+        limited = limited || other.limited;
+    }
+
+    /* Puts output from different paths into the order a serial DFS would
+     * have printed it, dropping anything a serial run would never have
+     * reached because it stopped at `last` first. */
+    void order_by_path(PathKey const* last) {
+        std::stable_sort(chunks.begin(), chunks.end(),
+            [](Chunk const& a, Chunk const& b) { return a.key < b.key; });
+        std::stable_sort(findings.begin(), findings.end(),
+            [](Finding const& a, Finding const& b) { return a.key < b.key; });
+        if (last) {
+            while (!chunks.empty() && *last < chunks.back().key) {
+                chunks.pop_back();
+            }
+            while (!findings.empty() && *last < findings.back().key) {
+                findings.pop_back();
+            }
+        }
+    }
+
+    FunctionResult result(void) const {
+        Verdict verdict = bounded ? Verdict::Bounded : Verdict::Verified;
+        for (Finding const& finding : findings) {
+            Verdict v = finding.kind == Finding::Error ? Verdict::Error
+                      : finding.kind == Finding::Counterexample ? Verdict::Failed
+                      : finding.kind == Finding::Stop ? Verdict::Stopped : Verdict::Unknown;
+            verdict = std::min(verdict, v);
+        }
+        return FunctionResult{name, verdict, findings, seconds, cached};
+    }
+
+    /* Replays the buffered output to stdout/stderr and clears it */
+    void flush(void) {
+        for (Chunk const& chunk : chunks) {
+            if (chunk.is_err) {
+                outs().flush(); // keep stdout and stderr interleaved correctly
+                errs() << chunk.text;
+            } else {
+                outs() << chunk.text;
+            }
+        }
+        outs().flush();
+        chunks.clear();
+    }
+};
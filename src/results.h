@@ -0,0 +1,166 @@
+#pragma once
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "report.h"
+
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+/* What checking one program came to, for batch mode (see driver.cpp) */
+struct ProgramResult final {
+    std::string name;               // the last of its files, as given
+    std::vector<std::string> files;
+    std::string error;              // why it couldn't be checked, if it couldn't
+    std::vector<FunctionResult> functions;
+    double seconds = 0;
+
+    /* Whether any function failed (or the program couldn't be checked) */
+    bool failed(void) const {
+        if (!error.empty()) return true;
+        for (FunctionResult const& f : functions) {
+            if (f.verdict == Verdict::Failed || f.verdict == Verdict::Error) return true;
+        }
+        return false;
+    }
+};
+
+static inline void write_json_string(raw_ostream& os, StringRef s) {
+    os << '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': os << "\\\""; break;
+            case '\\': os << "\\\\"; break;
+            case '\n': os << "\\n"; break;
+            case '\t': os << "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    os << format("\\u%04x", (unsigned) c);
+                } else {
+                    os << c;
+                }
+        }
+    }
+    os << '"';
+}
+
+/* {"programs": [{"name", "files", "error"?, "seconds", "functions": [{"name",
+ *  "verdict", "seconds", "cached", "findings": [{"kind", "what", "values"?}]}]}]} */
+static inline void write_json(raw_ostream& os, std::vector<ProgramResult> const& programs) {
+    static char const* const kinds[] = {"counterexample", "unknown", "stop", "error"};
+    os << "{\"programs\": [";
+    for (size_t p = 0; p < programs.size(); ++p) {
+        ProgramResult const& program = programs[p];
+        os << (p ? ",\n  " : "\n  ") << "{\"name\": ";
+        write_json_string(os, program.name);
+        os << ", \"files\": [";
+        for (size_t i = 0; i < program.files.size(); ++i) {
+            if (i) os << ", ";
+            write_json_string(os, program.files[i]);
+        }
+        os << "]";
+        if (!program.error.empty()) {
+            os << ", \"error\": ";
+            write_json_string(os, program.error);
+        }
+        os << ", \"seconds\": " << format("%.3f", program.seconds) << ", \"functions\": [";
+        for (size_t f = 0; f < program.functions.size(); ++f) {
+            FunctionResult const& function = program.functions[f];
+            os << (f ? ",\n    " : "\n    ") << "{\"name\": ";
+            write_json_string(os, function.name);
+            os << ", \"verdict\": \"" << verdict_name(function.verdict) << "\""
+               << ", \"seconds\": " << format("%.3f", function.seconds)
+               << ", \"cached\": " << (function.cached ? "true" : "false") << ", \"findings\": [";
+            for (size_t i = 0; i < function.findings.size(); ++i) {
+                Finding const& finding = function.findings[i];
+                os << (i ? ", " : "") << "{\"kind\": \"" << kinds[finding.kind] << "\", \"what\": ";
+                write_json_string(os, finding.what);
+                if (finding.kind == Finding::Counterexample) {
+                    os << ", \"values\": {";
+                    for (size_t v = 0; v < finding.values.size(); ++v) {
+                        if (v) os << ", ";
+                        write_json_string(os, finding.values[v].first);
+                        os << ": ";
+                        write_json_string(os, finding.values[v].second);
+                    }
+                    os << "}";
+                }
+                os << "}";
+            }
+            os << "]}";
+        }
+        os << (program.functions.empty() ? "]}" : "\n  ]}");
+    }
+    os << "\n]}\n";
+}
+
+static inline void write_xml_string(raw_ostream& os, StringRef s) {
+    for (char c : s) {
+        switch (c) {
+            case '&': os << "&amp;"; break;
+            case '<': os << "&lt;"; break;
+            case '>': os << "&gt;"; break;
+            case '"': os << "&quot;"; break;
+            case '\n': os << "&#10;"; break; // kept in attributes, too
+            default: os << c;
+        }
+    }
+}
+
+/* One <testsuite> per program and one <testcase> per function. Failed
+ * functions are failures (with their counterexamples), errors are errors,
+ * and functions Z0 couldn't settle (stopped or unknown) are skipped. A
+ * program that couldn't be checked is a suite with a single error. */
+static inline void write_junit(raw_ostream& os, std::vector<ProgramResult> const& programs) {
+    os << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n";
+    for (ProgramResult const& program : programs) {
+        unsigned failures = 0, errors = program.error.empty() ? 0 : 1;
+        for (FunctionResult const& function : program.functions) {
+            failures += function.verdict == Verdict::Failed;
+            errors += function.verdict == Verdict::Error;
+        }
+        size_t tests = program.error.empty() ? program.functions.size() : 1;
+        os << "  <testsuite name=\"";
+        write_xml_string(os, program.name);
+        os << "\" tests=\"" << tests << "\" failures=\"" << failures << "\" errors=\"" << errors
+           << "\" time=\"" << format("%.3f", program.seconds) << "\">\n";
+        if (!program.error.empty()) {
+            os << "    <testcase name=\"(compile)\"><error message=\"";
+            write_xml_string(os, program.error);
+            os << "\"/></testcase>\n";
+        }
+        for (FunctionResult const& function : program.functions) {
+            os << "    <testcase classname=\"";
+            write_xml_string(os, program.name);
+            os << "\" name=\"";
+            write_xml_string(os, function.name);
+            os << "\" time=\"" << format("%.3f", function.seconds) << "\"";
+            Finding::Kind kind = function.verdict == Verdict::Failed ? Finding::Counterexample
+                               : function.verdict == Verdict::Error ? Finding::Error
+                               : function.verdict == Verdict::Stopped ? Finding::Stop
+                               : Finding::Unknown;
+            char const* element = function.verdict == Verdict::Failed ? "failure"
+                                : function.verdict == Verdict::Error ? "error" : "skipped";
+            Finding const* first = nullptr;
+            for (Finding const& finding : function.findings) {
+                if (finding.kind == kind) { first = &finding; break; }
+            }
+            if (function.verdict == Verdict::Verified || function.verdict == Verdict::Bounded
+                || !first) {
+                os << "/>\n";
+                continue;
+            }
+            os << "><" << element << " message=\"";
+            write_xml_string(os, first->what);
+            os << "\">";
+            for (auto const& value : first->values) {
+                write_xml_string(os, value.first + " = " + value.second + "\n");
+            }
+            os << "</" << element << "></testcase>\n";
+        }
+        os << "  </testsuite>\n";
+    }
+    os << "</testsuites>\n";
+}
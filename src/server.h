@@ -0,0 +1,226 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+/* Answers requests on a Unix socket for as long as the process lives (see
+ * driver.cpp's -serve). A client connects, sends one line, and reads the
+ * answer until the connection closes. The first word of the line tags it,
+ * say with the file an editor is checking: a request still running (or
+ * still waiting its turn) when a later one with the same tag arrives is
+ * stale, and is told to stop.
+ * One thread accepts connections and reads their lines, so a request is
+ * known (and can make older ones stale) as soon as it arrives; a fixed
+ * number of threads answer them in the order they arrived.
+ */
+class Server final {
+public:
+    /* Answers request, giving up early once cancelled is set */
+    using Handler = std::function<std::string(StringRef request, std::atomic<bool> const& cancelled)>;
+
+private:
+    /* A connection whose line is still coming in */
+    struct Reading {
+        int fd;
+        std::string line;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    /* A request waiting for a thread to answer it */
+    struct Request {
+        int fd;
+        std::string line;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+    };
+
+    static const size_t max_line = 1 << 16;
+
+    Handler const handler;
+    unsigned const jobs;
+    std::mutex lock;
+    std::map<std::string, std::shared_ptr<std::atomic<bool>>> latest; // by tag; under lock
+    std::deque<Request> waiting;                                      // under lock
+    std::condition_variable wake;
+    bool stopping = false;                                            // under lock
+
+    static void write_all(int fd, std::string const& text) {
+        size_t done = 0;
+        while (done < text.size()) {
+            ssize_t n = write(fd, text.data() + done, text.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return; // the client went away
+            done += n;
+        }
+    }
+
+    /* Queues a request that has just arrived, making older ones with its
+     * tag stale */
+    void submit(int fd, std::string line) {
+        std::string tag = StringRef(line).trim().split(' ').first.str();
+        auto cancelled = std::make_shared<std::atomic<bool>>(false);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            std::shared_ptr<std::atomic<bool>>& newest = latest[tag];
+            if (newest) *newest = true;
+            newest = cancelled;
+            waiting.push_back(Request{fd, std::move(line), cancelled});
+        }
+        wake.notify_one();
+    }
+
+    /* Reads what has come in on a connection. Returns whether it is done
+     * with: its line is complete (and submitted), or it never will be. */
+    bool read_some(Reading& client) {
+        char buffer[4096];
+        ssize_t n = read(client.fd, buffer, sizeof(buffer));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return false;
+        if (n > 0) {
+            client.line.append(buffer, n);
+            size_t end = client.line.find('\n');
+            if (end == std::string::npos) {
+                if (client.line.size() <= max_line) return false;
+                close(client.fd);
+                return true;
+            }
+            client.line.resize(end);
+        }
+        if (n < 0 || client.line.empty()) {
+            close(client.fd);
+        } else {
+            submit(client.fd, std::move(client.line));
+        }
+        return true;
+    }
+
+    void work(void) {
+        while (true) {
+            Request request;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                while (waiting.empty() && !stopping) wake.wait(guard);
+                if (waiting.empty()) return;
+                request = std::move(waiting.front());
+                waiting.pop_front();
+            }
+            write_all(request.fd, handler(StringRef(request.line).trim(), *request.cancelled));
+            close(request.fd);
+        }
+    }
+
+    /* Lets the workers finish what has arrived, and waits for them */
+    void stop(std::vector<std::thread>& workers) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+public:
+    /* Answers up to jobs requests at once (at least one) */
+    Server(Handler handler, unsigned jobs) : handler(std::move(handler)), jobs(jobs ? jobs : 1) {}
+
+    /* Listens at path (replacing whatever socket was left there) until
+     * something goes wrong, which it reports */
+    bool serve(std::string const& path) {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            errs() << "z0: socket path too long: " << path << "\n";
+            return false;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            errs() << "z0: socket: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        unlink(path.c_str());
+        if (bind(listener, (sockaddr*) &address, sizeof(address)) < 0
+            || listen(listener, 16) < 0) {
+            errs() << "z0: " << path << ": " << std::strerror(errno) << "\n";
+            close(listener);
+            return false;
+        }
+        signal(SIGPIPE, SIG_IGN); // a client that hangs up shouldn't take the server down
+        errs() << "z0: listening on " << path << "\n";
+        std::vector<std::thread> workers;
+        for (unsigned j = 0; j < jobs; ++j) {
+            workers.emplace_back(&Server::work, this);
+        }
+
+        // A client gets this long to send its line, so a silent one can't
+        // hold on to its connection forever
+        auto const patience = std::chrono::seconds(10);
+        std::vector<Reading> reading;
+        while (true) {
+            std::vector<pollfd> fds{pollfd{listener, POLLIN, 0}};
+            for (Reading const& client : reading) {
+                fds.push_back(pollfd{client.fd, POLLIN, 0});
+            }
+            if (poll(fds.data(), fds.size(), 1000) < 0) {
+                if (errno == EINTR) continue;
+                errs() << "z0: poll: " << std::strerror(errno) << "\n";
+                break;
+            }
+            auto now = std::chrono::steady_clock::now();
+            // Backwards, so removing a client only moves ones already seen to
+            for (size_t i = reading.size(); i-- > 0; ) {
+                bool done;
+                if (fds[i + 1].revents) {
+                    done = read_some(reading[i]);
+                } else if (now - reading[i].since > patience) {
+                    close(reading[i].fd);
+                    done = true;
+                } else {
+                    done = false;
+                }
+                if (done) {
+                    reading[i] = std::move(reading.back());
+                    reading.pop_back();
+                }
+            }
+            if (fds[0].revents & POLLIN) {
+                int fd = accept(listener, nullptr, nullptr);
+                if (fd >= 0) {
+                    reading.push_back(Reading{fd, std::string(), now});
+                } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+                    errs() << "z0: accept: " << std::strerror(errno) << "\n";
+                    break;
+                }
+            }
+        }
+        for (Reading const& client : reading) {
+            close(client.fd);
+        }
+        close(listener);
+        stop(workers);
+        return false;
+    }
+};
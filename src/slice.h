@@ -0,0 +1,109 @@
+#pragma once
+
+#include "z3++.h"
+#include "cache.h"
+#include "stats.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+Z0_STATISTIC(NumSlicedQueries, "Queries cut down to the constraints they depend on");
+Z0_STATISTIC(NumSubQueries, "Independent sub-queries solved for sliced queries");
+Z0_STATISTIC(NumConstraintsSliced, "Constraints left out of queries by slicing");
+
+/* Splits constraints into independent groups: two constraints are in the
+ * same group if they (transitively) share a variable. Uninterpreted
+ * functions (array lengths, say) count as variables too, whatever they are
+ * applied to, since two applications may have to agree with no constant in
+ * common. A group none of whose constraints are new since the path was
+ * last found satisfiable is still satisfiable, so only the groups touching
+ * new constraints need checking.
+ */
+class Slicer final {
+    z3::context& cxt;
+    /* The variables of each constraint seen so far, by AST id. Entries keep
+     * their constraint alive, so AST ids can't be recycled under them. */
+    struct Vars {
+        z3::expr constraint;
+        std::vector<unsigned int> ids;
+    };
+    std::unordered_map<unsigned int, Vars> vars_of;
+
+    static size_t find(std::vector<size_t>& parent, size_t i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+public:
+    explicit Slicer(z3::context& cxt) : cxt(cxt) {}
+
+    /* The AST ids of the uninterpreted constants e mentions, and of the
+     * declarations of the uninterpreted functions it applies */
+    std::vector<unsigned int> const& variables(z3::expr const& e) {
+        unsigned int id = Z3_get_ast_id(cxt, e);
+        auto found = vars_of.find(id);
+        if (found != vars_of.end()) return found->second.ids;
+        std::vector<unsigned int> vars;
+        std::unordered_set<unsigned int> seen;
+        std::vector<z3::expr> todo{e};
+        while (!todo.empty()) {
+            z3::expr next = todo.back();
+            todo.pop_back();
+            if (!next.is_app() || !seen.insert(Z3_get_ast_id(cxt, next)).second) continue;
+            if (next.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+                if (next.is_const()) {
+                    vars.push_back(Z3_get_ast_id(cxt, next));
+                    continue;
+                }
+                vars.push_back(Z3_get_ast_id(cxt, next.decl()));
+            }
+            for (unsigned i = 0; i < next.num_args(); ++i) {
+                todo.push_back(next.arg(i));
+            }
+        }
+        return vars_of.emplace(id, Vars{e, std::move(vars)}).first->second.ids;
+    }
+
+    /* The groups of constraints that contain a constraint marked `fresh`,
+     * each as its own query, with constraints kept in their original order */
+    std::vector<Query> slice(std::vector<z3::expr> const& constraints,
+                             std::vector<bool> const& fresh) {
+        // Union-find over constraints, joined through their variables
+        std::vector<size_t> parent(constraints.size());
+        std::unordered_map<unsigned int, size_t> owner; // variable -> a constraint using it
+        for (size_t i = 0; i < constraints.size(); ++i) {
+            parent[i] = i;
+            for (unsigned int var : variables(constraints[i])) {
+                auto found = owner.emplace(var, i);
+                if (!found.second) {
+                    parent[find(parent, i)] = find(parent, found.first->second);
+                }
+            }
+        }
+        std::unordered_map<size_t, size_t> group_of_root;
+        for (size_t i = 0; i < constraints.size(); ++i) {
+            if (fresh[i]) group_of_root.emplace(find(parent, i), group_of_root.size());
+        }
+        std::vector<Query> groups(group_of_root.size());
+        size_t kept = 0;
+        for (size_t i = 0; i < constraints.size(); ++i) {
+            auto group = group_of_root.find(find(parent, i));
+            if (group == group_of_root.end()) continue;
+            groups[group->second].constraints.push_back(constraints[i]);
+            ++kept;
+        }
+        for (Query& query : groups) {
+            query.seal(cxt);
+        }
+        ++NumSlicedQueries;
+        NumSubQueries += groups.size();
+        NumConstraintsSliced += constraints.size() - kept;
+        return groups;
+    }
+
+    void clear(void) { vars_of.clear(); }
+};
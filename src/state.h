@@ -8,13 +8,28 @@
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Argument.h"
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/ADT/Optional.h"
+#include "pmap.h"
+#include "cache.h"
+#include "slice.h"
+#include "portfolio.h"
+#include "abstract.h"
+#include "cores.h"
+#include "interval.h"
+#include "heap.h"
+#include "stats.h"
 #include "z3++.h"
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <vector>
 #include <tuple>
+#include <memory>
 #include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <chrono>
 
 using std::string;
 using std::tuple;
@@ -22,6 +37,12 @@ using namespace llvm;
 
 #define DEBUG_TYPE "Z0State" /* For LLVM's DEBUG macro */
 
+Z0_STATISTIC(NumReprHits, "Values z3_repr had already encoded");
+Z0_STATISTIC(NumReprsBuilt, "Values z3_repr encoded");
+Z0_STATISTIC(NumConstantsBuilt, "Integer constants built");
+Z0_STATISTIC(NumSortsBuilt, "Bit-vector sorts built");
+Z0_STATISTIC(NumEncodeNanos, "Nanoseconds spent encoding values");
+
 
 struct StopZ0 final {
     std::string const why;
@@ -32,80 +53,401 @@ struct StopZ0 final {
     explicit StopZ0(std::string const& why) :StopZ0(why.c_str()) {}
 };
 
-struct UnreachablePath final {};
-
 enum BitWidth { I1=1u, I32=32u };
+
+/* How Z0State poses queries to z3 */
+struct SolverConfig final {
+    /* Guard each frame and check with a literal and check under assumptions,
+     * instead of pushing and popping solver scopes. z3 keeps what it learned
+     * about one path when moving on to the next. */
+    bool incremental = false;
+    /* How many query results to remember per function (0 = no cache) */
+    unsigned int cache_size = 0;
+    /* Only check the constraints that share variables with those added since
+     * the path was last found satisfiable, as independent sub-queries */
+    bool slice = false;
+    /* Give instructions their defining expressions instead of a symbol and an
+     * equality, so z3 sees expression DAGs rather than one equation each */
+    bool substitute = false;
+    /* Limits on each query, in milliseconds and z3 resource units (0 = none).
+     * A query that hits one comes back unknown. */
+    unsigned int query_timeout = 0;
+    unsigned int query_rlimit = 0;
+    /* Race several solver strategies on threads of their own for each check */
+    bool portfolio = false;
+    /* Milliseconds to try arithmetic-heavy queries over the integers for,
+     * before bit-blasting them (0 = don't) */
+    unsigned int abstract_timeout = 0;
+    /* How many unsat cores of infeasible paths to remember per function
+     * (0 = don't learn any) */
+    unsigned int core_limit = 0;
+    /* Try to decide each check with interval reasoning before asking z3 */
+    bool prepass = false;
+};
+
+/* What a source variable currently holds: an LLVM value or, once paths
+ * assigning it different values have been merged, a fresh symbol */
+struct LocalInfo {
+    DILocalVariable const* var;
+    ValueAsMetadata const* val; // null if merged
+    unsigned int merged_id;     // 0 unless merged
+    unsigned int merged_width;
+
+    bool operator==(LocalInfo const& other) const {
+        return val == other.val && merged_id == other.merged_id;
+    }
+    bool operator!=(LocalInfo const& other) const { return !(*this == other); }
+};
+
+/* Source variables by name. Every path keeps its own version, and paths
+ * leaving a branch share everything they haven't assigned since. */
+using VarMap = PersistentMap<StringRef, LocalInfo>;
+
+/* Values a path has given fresh symbols, by symbol id. Cutting a loop havocs
+ * what it computes, so on that path those values no longer mean what they
+ * meant on entry to the loop; what a load reads depends on the path's heap. */
+using Renames = PersistentMap<Value const*, unsigned int>;
+
+/* How many times a path has gone back round each unrolled loop it is in,
+ * by header */
+using Trips = PersistentMap<BasicBlock const*, unsigned int>;
+
+/* The assertions a path added since it last forked. Frames form a tree:
+ * the paths leaving a branch share everything up to their parent frame. */
+struct Frame final {
+    std::shared_ptr<Frame> parent;
+    std::vector<z3::expr> assertions;
+    std::vector<BasicBlock const*> blocks; // run in this frame, for debugging
+
+    /* In incremental mode: the literal guarding this frame's assertions in
+     * the solver, and how many of them have been added so far */
+    Optional<z3::expr> literal;
+    size_t asserted = 0;
+
+    /* How many of the assertions are known satisfiable (with the ancestors') */
+    size_t checked = 0;
+
+    explicit Frame(std::shared_ptr<Frame> parent) : parent(std::move(parent)) {}
+
+    ~Frame() {
+        // Free long chains of frames iteratively instead of recursively
+        std::shared_ptr<Frame> next = std::move(parent);
+        while (next && next.use_count() == 1) {
+            next = std::move(next->parent);
+        }
+    }
+};
+
+/* A copy of one path's state, translated into a z3::context of its own so
+ * that it can be handed to (and resumed on) another thread. */
+struct PathSnapshot final {
+    std::unique_ptr<z3::context> cxt;
+    std::unique_ptr<z3::expr_vector> assertions;
+    unsigned int count;
+    std::unordered_map<Value const*, unsigned int> val2id;
+    std::unordered_map<Value const*, z3::expr> defs;
+    VarMap name2val;
+    Renames renamed;
+    Heap heap;
+};
+
 /* Z0 solver state */
 class Z0State final {
     // Identifiers:
     unsigned int count = 0;
-    std::unordered_map<Value const*, z3::symbol> val2symbol;
+    std::unordered_map<Value const*, unsigned int> val2id;
+    std::unique_ptr<z3::context> owned_cxt;
+    /* With config.substitute, what each instruction run so far computes.
+     * An SSA value means the same thing on every path that reaches it. */
+    std::unordered_map<Value const*, z3::expr> defs;
+    /* What z3_repr made of each value in this function, so that operands are
+     * encoded once instead of once per use on every path */
+    std::unordered_map<Value const*, z3::expr> reprs;
+    /* Integer constants by width and value, and bit-vector sorts by width */
+    std::unordered_map<uint64_t, z3::expr> constants;
+    std::unordered_map<unsigned int, z3::sort> sorts;
+
+    /* The frames whose assertions are in the solver, one scope each */
+    std::vector<std::shared_ptr<Frame>> active;
+    /* Scopes pushed on top of the active frames for a single check */
+    unsigned int check_scopes = 0;
+    /* In incremental mode, the literal guarding each check scope */
+    std::vector<z3::expr> check_literals;
+    unsigned int literal_count = 0;
+    /* Frame literals in the solver, so those of dead frames can be retired */
+    std::vector<std::pair<std::weak_ptr<Frame>, z3::expr>> frame_literals;
+    size_t live_literals = 0;
+    /* Definitions already in the solver (by z3 AST id), in incremental mode */
+    std::unordered_set<unsigned int> defined;
+    /* Assertions made in each open check scope */
+    std::vector<z3::expr> scoped;
+    std::vector<size_t> scope_marks;
+
+    std::unique_ptr<QueryCache> cache;
+    std::unique_ptr<Portfolio> portfolio;
+    std::unique_ptr<AbstractSolver> abstraction;
+    std::unique_ptr<CoreStore> cores;
+    /* What a solver (rather than the cache) last found unsat, if anything */
+    Optional<Query> refuted;
+    /* The model for the last sat check, if it came from the cache */
+    Optional<z3::model> cached_model;
+    /* Whether the last sat check left no model of the whole path (it was
+     * sliced, or decided without z3) */
+    bool sliced = false;
+    /* Why the last check came back unknown */
+    std::string unknown_reason;
+    /* No query may run past this */
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
 
 public:
-    using LocalInfo = std::pair<DILocalVariable const*, ValueAsMetadata const*>;
-    std::map<StringRef, LocalInfo> name2val;
-    std::vector<std::map<StringRef, LocalInfo>> n2vstack;
-    std::vector<BasicBlock const*> bbstack;
+    VarMap name2val;
+    Renames renamed;
+    Heap heap;
 
-    z3::context cxt;
+    z3::context& cxt;
     z3::sort z0_int_sort = cxt.bv_sort(32);
+    /* Arrays never change length, so the length of an array from outside
+     * the path is a function of the array (see array_length) */
+    z3::func_decl length_fn = cxt.function("length", cxt.bv_sort(64), cxt.bv_sort(32));
 
     z3::solver solver;
+    SolverConfig config;
+    Slicer slicer{cxt};
+    /* The interval facts of the active path's checked assertions, with how
+     * many of each frame's assertions they have (see prepass_decide) */
+    Prepass prepass{cxt, slicer};
+    std::vector<std::pair<std::shared_ptr<Frame>, size_t>> prepass_basis;
+
+    void configure(SolverConfig const& config) {
+        this->config = config;
+        cache.reset(config.cache_size ? new QueryCache(config.cache_size) : nullptr);
+        portfolio.reset(config.portfolio ? new Portfolio(cxt) : nullptr);
+        abstraction.reset(config.abstract_timeout ? new AbstractSolver(cxt) : nullptr);
+        cores.reset(config.core_limit ? new CoreStore(config.core_limit) : nullptr);
+    }
+
+    void set_deadline(std::chrono::steady_clock::time_point when) {
+        deadline = when;
+    }
+
+    explicit Z0State(void)
+        : owned_cxt(new z3::context()), cxt(*owned_cxt), solver(cxt) {}
+
+    /* Resumes a path from a snapshot, taking over its context.
+     * The snapshot's assertions stay in the snapshot, for the caller to put
+     * in a frame. */
+    explicit Z0State(PathSnapshot& snap)
+        : count(snap.count), val2id(std::move(snap.val2id)),
+          owned_cxt(std::move(snap.cxt)), defs(std::move(snap.defs)),
+          name2val(std::move(snap.name2val)), renamed(std::move(snap.renamed)),
+          heap(std::move(snap.heap)), cxt(*owned_cxt), solver(cxt) {}
+
+    /* Copies a path into a fresh context */
+    PathSnapshot snapshot(Frame const& frame, VarMap const& vars, Renames const& renames,
+                          Heap const& memory) {
+        PathSnapshot snap;
+        snap.cxt.reset(new z3::context());
+        snap.assertions.reset(new z3::expr_vector(*snap.cxt));
+        std::vector<Frame const*> chain;
+        for (Frame const* f = &frame; f; f = f->parent.get()) {
+            chain.push_back(f);
+        }
+        for (auto f = chain.rbegin(); f != chain.rend(); ++f) {
+            for (z3::expr const& e : (*f)->assertions) {
+                Z3_ast a = Z3_translate(cxt, e, *snap.cxt);
+                snap.assertions->push_back(z3::to_expr(*snap.cxt, a));
+            }
+        }
+        snap.count = count;
+        snap.val2id = val2id;
+        for (auto const& def : defs) {
+            Z3_ast a = Z3_translate(cxt, def.second, *snap.cxt);
+            snap.defs.emplace(def.first, z3::to_expr(*snap.cxt, a));
+        }
+        snap.name2val = vars;
+        snap.renamed = renames;
+        snap.heap = memory;
+        return snap;
+    }
+
+    /* Makes the solver hold exactly the assertions along frame's path.
+     * Frames shared with the previously active path stay put, so going from
+     * a path to its sibling only pops and pushes one scope. */
+    void activate(std::shared_ptr<Frame> const& frame) {
+        assert(check_scopes == 0 && "activating a path in the middle of a check");
+        std::vector<std::shared_ptr<Frame>> chain;
+        for (std::shared_ptr<Frame> f = frame; f; f = f->parent) {
+            chain.push_back(f);
+        }
+        std::reverse(chain.begin(), chain.end());
+        if (config.incremental) {
+            /* Nothing is ever popped: switching paths just switches which
+             * frame literals get assumed */
+            retire_dead_frames();
+            for (std::shared_ptr<Frame> const& f : chain) {
+                if (!f->literal) {
+                    f->literal = fresh_literal();
+                    frame_literals.emplace_back(f, *f->literal);
+                }
+                for (; f->asserted < f->assertions.size(); ++f->asserted) {
+                    solver.add(z3::implies(*f->literal, f->assertions[f->asserted]));
+                }
+            }
+            active = std::move(chain);
+            return;
+        }
+        size_t common = 0;
+        while (common < active.size() && common < chain.size()
+               && active[common] == chain[common]) {
+            ++common;
+        }
+        if (active.size() > common) {
+            solver.pop(active.size() - common);
+            active.resize(common);
+        }
+        for (size_t i = common; i < chain.size(); ++i) {
+            solver.push();
+            for (z3::expr const& e : chain[i]->assertions) {
+                solver.add(e);
+            }
+            active.push_back(chain[i]);
+        }
+    }
 
-    explicit Z0State(void) : solver(cxt) {}
+    /* Asserts the negation of the literals of frames no path uses any more,
+     * letting z3 throw away the clauses they guard. Only sweeps once the
+     * number of literals has doubled, to keep activate cheap. */
+    void retire_dead_frames(void) {
+        if (frame_literals.size() < 2 * live_literals + 64) return;
+        std::vector<std::pair<std::weak_ptr<Frame>, z3::expr>> live;
+        for (auto& entry : frame_literals) {
+            if (entry.first.expired()) {
+                solver.add(!entry.second);
+            } else {
+                live.push_back(std::move(entry));
+            }
+        }
+        frame_literals = std::move(live);
+        live_literals = frame_literals.size();
+    }
 
     void update_ident(DILocalVariable const* local, ValueAsMetadata const* val) {
         DEBUG(dbgs() << "updating entry for " << local->getName() << "\n");
-        name2val[local->getName()] = {local, val};
+        name2val.set(local->getName(), LocalInfo{local, val, 0, 0});
     }
 
-    z3::expr bv_val(int32_t i, BitWidth bitwidth) {
-        return cxt.bv_val(i, bitwidth);
+    z3::expr bv_val(int32_t i, unsigned int width) {
+        uint64_t key = (uint64_t) width << 32 | (uint32_t) i;
+        auto it = constants.find(key);
+        if (it == constants.end()) {
+            ++NumConstantsBuilt;
+            it = constants.emplace(key, cxt.bv_val(i, width)).first;
+        }
+        return it->second;
     }
 
-    z3::symbol& symbol(Value const* v) {
-        auto it = val2symbol.find(v);
-        if (it == val2symbol.end()) {
-            auto res = val2symbol.emplace(v, cxt.int_symbol(++count));
-            return res.first->second;
+    z3::sort bv_sort(unsigned int width) {
+        auto it = sorts.find(width);
+        if (it == sorts.end()) {
+            ++NumSortsBuilt;
+            it = sorts.emplace(width, cxt.bv_sort(width)).first;
         }
         return it->second;
     }
 
-    z3::symbol* lookup_symbol(Value const* v) {
-        auto it = val2symbol.find(v);
-        return (it == val2symbol.end()) ? nullptr : &(it->second);
+    z3::symbol symbol(Value const* v) {
+        if (unsigned int const* id = renamed.lookup(v)) return cxt.int_symbol(*id);
+        auto it = val2id.find(v);
+        if (it == val2id.end()) {
+            it = val2id.emplace(v, ++count).first;
+        }
+        return cxt.int_symbol(it->second);
+    }
+
+    Optional<z3::symbol> lookup_symbol(Value const* v) {
+        if (unsigned int const* id = renamed.lookup(v)) return cxt.int_symbol(*id);
+        auto it = val2id.find(v);
+        if (it == val2id.end()) return None;
+        return cxt.int_symbol(it->second);
     }
 
     z3::symbol fresh_symbol(void) {
         return cxt.int_symbol(++count);
     }
 
-    /* Requires v to have an integer llvm type */
+    unsigned int fresh_id(void) {
+        return ++count;
+    }
+
+    /* Gives v a fresh symbol on the current path */
+    void rename(Value const* v) {
+        renamed.set(v, fresh_id());
+    }
+
+    z3::expr bv_constant(unsigned int id, unsigned int width) {
+        return cxt.constant(cxt.int_symbol(id), bv_sort(width));
+    }
+
+    z3::expr fresh_bool(void) {
+        return cxt.constant(fresh_symbol(), cxt.bool_sort());
+    }
+
+    /* A guard literal for incremental mode. These are named apart from
+     * program symbols so they don't change how counterexamples are numbered. */
+    z3::expr fresh_literal(void) {
+        std::string name = "guard!" + std::to_string(++literal_count);
+        return cxt.bool_const(name.c_str());
+    }
+
+    /* Requires v to have an integer or pointer llvm type */
     z3::expr bv_constant(Value const* v) {
-        assert(llvm::isa<IntegerType>(v->getType()));
-        IntegerType *type = llvm::cast<IntegerType>(v->getType());
-        z3::symbol& name = this->symbol(v);
-        return cxt.constant(name, cxt.bv_sort(type->getBitWidth()));
+        assert(width_of(v->getType()) && "value has no representation");
+        z3::symbol name = this->symbol(v);
+        return cxt.constant(name, bv_sort(width_of(v->getType())));
     }
 
     /* gets the z3 representation of an llvm value*/
     z3::expr z3_repr(Value const* val) {
+        if (!renamed.empty()) {
+            if (unsigned int const* id = renamed.lookup(val)) {
+                return bv_constant(*id, width_of(val->getType()));
+            }
+        }
+        auto def = defs.find(val);
+        if (def != defs.end()) return def->second;
+        auto known = reprs.find(val);
+        if (known != reprs.end()) {
+            ++NumReprHits;
+            return known->second;
+        }
+        auto start = std::chrono::steady_clock::now();
+        z3::expr e = encode(val);
+        reprs.emplace(val, e);
+        ++NumReprsBuilt;
+        NumEncodeNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        return e;
+    }
+
+    /* Builds the z3 representation of val from scratch */
+    z3::expr encode(Value const* val) {
         if (ConstantInt const* n = dyn_cast<ConstantInt>(val)) {
             if (val->getType()->isIntegerTy(1)
             || val->getType()->isIntegerTy(8)
             || val->getType()->isIntegerTy(32)) {
-                return cxt.bv_val((int)n->getSExtValue(), n->getBitWidth());
+                return bv_val((int)n->getSExtValue(), n->getBitWidth());
             } else {
                 DEBUG(val->dump());
                 throw StopZ0("weird-width integer");
             }
+        } else if (isa<ConstantPointerNull>(val)) {
+            return bv_val(0, 64);
         } else if (isa<Instruction>(val) || isa<Argument>(val)) {
-            if (IntegerType const* t = dyn_cast<IntegerType>(val->getType())) {
-                return cxt.constant(symbol(val), cxt.bv_sort(t->getBitWidth()));
+            if (unsigned width = width_of(val->getType())) {
+                return cxt.constant(symbol(val), bv_sort(width));
             } else {
                 DEBUG(val->dump());
-                throw StopZ0("Instruction/argument doesn't have integer type!");
+                throw StopZ0("Instruction/argument doesn't have integer or pointer type!");
             }
         } else {
             DEBUG(val->dump());
@@ -113,46 +455,456 @@ public:
         }
     }
 
-    void push(BasicBlock const* bb=nullptr) {
-        n2vstack.push_back(std::map<StringRef, LocalInfo>(name2val.begin(), name2val.end()));
-        solver.push();
-        bbstack.push_back(bb);
+    /* Opens a scope for a single check; nothing added inside it is
+     * remembered as part of the path */
+    void push(void) {
+        scope_marks.push_back(scoped.size());
+        if (config.incremental) {
+            check_literals.push_back(fresh_literal());
+        } else {
+            solver.push();
+        }
+        ++check_scopes;
     }
 
     void pop(void) {
-        name2val = std::move(*n2vstack.rbegin());
-        n2vstack.pop_back();
-        solver.pop();
-        bbstack.pop_back();
+        assert(check_scopes > 0);
+        scoped.erase(scoped.begin() + scope_marks.back(), scoped.end());
+        scope_marks.pop_back();
+        if (config.incremental) {
+            // Retire the literal for good, so z3 can drop what it guards
+            solver.add(!check_literals.back());
+            check_literals.pop_back();
+        } else {
+            solver.pop();
+        }
+        --check_scopes;
     }
 
-    void show_path(BasicBlock const* bb) {
+    void show_path(raw_ostream& os, BasicBlock const* bb) {
         if (bb) {
-            outs() << bb->getName();
+            os << bb->getName();
         } else {
-            outs() << "(entry)";
+            os << "(entry)";
         }
 
-        for (BasicBlock const* bb : bbstack) {
-            if (bb) {
-                outs()<< " -> " << bb->getName();
+        for (auto const& frame : active) {
+            for (BasicBlock const* bb : frame->blocks) {
+                os << " -> " << bb->getName();
             }
         }
-        outs() << "\n";
+        os << "\n";
     }
 
     void assert_eq(z3::expr a, z3::expr b) {
-        solver.add(a == b);
+        add(a == b);
     }
+
+    /* Asserts that the symbol a is defined as b. An SSA value has the same
+     * definition on every path that reaches it, so in incremental mode
+     * definitions go into the solver unguarded, once, for all paths to share. */
+    void define(z3::expr a, z3::expr b) {
+        if (!config.incremental || check_scopes > 0 || active.empty()) {
+            assert_eq(a, b);
+            return;
+        }
+        z3::expr e = a == b;
+        Frame& frame = *active.back();
+        frame.assertions.push_back(e); // still needed for snapshots
+        ++frame.asserted;
+        if (defined.insert(Z3_get_ast_id(cxt, e)).second) {
+            solver.add(e);
+        }
+    }
+    /* Records what the instruction v computes: as its expression itself with
+     * config.substitute, otherwise as a definition of v's symbol. Once a path
+     * has renamed anything, what it computes from then on may depend on that
+     * and mean something different on other paths, so each value gets a
+     * fresh symbol (and a definition) of its own. */
+    void define_value(Value const* v, z3::expr e) {
+        if (!renamed.empty()) {
+            rename(v);
+        } else if (config.substitute) {
+            defs.emplace(v, e);
+            return;
+        }
+        define(bv_constant(v), e);
+    }
+
+    /* Like define_value, for a value that means something different on
+     * every path even so (what a load reads, say) */
+    void define_fresh(Value const* v, z3::expr e) {
+        rename(v);
+        define(bv_constant(v), e);
+    }
+
+    /* The z3 array holding region's cells on the active path */
+    z3::expr region_array(Region const& region) {
+        if (RegionVersion const* version = heap.versions.lookup(region.key)) {
+            return cxt.constant(cxt.int_symbol(version->id), region_sort(region));
+        }
+        // As on entry to the function, bar the path's own allocations
+        std::string name = "heap!" + region.key;
+        z3::expr contents = cxt.constant(name.c_str(), region_sort(region));
+        bool zeroed = false;
+        for (auto const& object : heap.allocated) {
+            if (object.second != region.array) continue;
+            contents = z3::store(contents, address(object.first), zero_cell(region));
+            zeroed = true;
+        }
+        return zeroed ? update_region(region, contents) : contents;
+    }
+
+    /* Makes contents the region's new version on the active path */
+    z3::expr update_region(Region const& region, z3::expr contents) {
+        unsigned int id = fresh_id();
+        z3::expr version = cxt.constant(cxt.int_symbol(id), region_sort(region));
+        define(version, contents);
+        heap.versions.set(region.key, RegionVersion{id, region});
+        return version;
+    }
+
+    /* Forgets everything about region's cells on the active path */
+    void havoc_region(Region const& region) {
+        heap.versions.set(region.key, RegionVersion{fresh_id(), region});
+    }
+
+    /* The cell at `at` (whose object and index are given), on the active path */
+    z3::expr load(Location const& at, z3::expr object, Optional<z3::expr> index) {
+        z3::expr cells = z3::select(region_array(at.region), object);
+        return index ? z3::select(cells, *index) : cells;
+    }
+
+    void store(Location const& at, z3::expr object, Optional<z3::expr> index, z3::expr value) {
+        z3::expr contents = region_array(at.region);
+        z3::expr cell = index ? z3::store(z3::select(contents, object), *index, value) : value;
+        update_region(at.region, z3::store(contents, object, cell));
+    }
+
+    /* A fresh object (or array), which starts out zero in every region */
+    z3::expr allocate(bool array) {
+        unsigned int id = fresh_id();
+        z3::expr object = address(id);
+        // Regions the path hasn't touched are zeroed when it first does
+        auto versions = heap.versions;
+        for (auto const& entry : versions) {
+            Region const& region = entry.second.region;
+            if (region.array != array) continue;
+            update_region(region, z3::store(region_array(region), object, zero_cell(region)));
+        }
+        heap.allocated.set(id, array);
+        return object;
+    }
+
+    /* The length of the array allocated at id, a symbol of its own */
+    z3::expr allocation_length(unsigned int id) {
+        std::string name = "length!" + std::to_string(id);
+        return cxt.constant(name.c_str(), bv_sort(32));
+    }
+
+    /* Each array the path allocates has a length symbol of its own, so
+     * facts about different arrays' lengths have nothing in common; other
+     * arrays' lengths are length_fn of the array */
+    z3::expr array_length(z3::expr array) {
+        __uint64 at;
+        if (array.is_numeral() && Z3_get_numeral_uint64(cxt, array, &at) && at >= FirstAllocation) {
+            if (bool const* is_array = heap.allocated.lookup(at - FirstAllocation)) {
+                if (*is_array) return allocation_length(at - FirstAllocation);
+            }
+        }
+        z3::expr length = length_fn(array);
+        for (auto const& object : heap.allocated) {
+            if (!object.second) continue;
+            length = z3::ite(array == address(object.first), allocation_length(object.first), length);
+        }
+        return length;
+    }
+
+    /* What is known about array's length. Asserted for each array a path
+     * uses, instead of for every array up front. */
+    z3::expr length_facts(z3::expr array) {
+        z3::expr length = array_length(array);
+        return length >= bv_val(0, 32) && z3::implies(array == bv_val(0, 64), length == bv_val(0, 32));
+    }
+
+    z3::expr address(unsigned int allocation) {
+        return cxt.bv_val((__uint64) (FirstAllocation + allocation), 64);
+    }
+
+    z3::sort region_sort(Region const& region) {
+        z3::sort cells = bv_sort(region.width);
+        if (region.array) cells = cxt.array_sort(bv_sort(32), cells);
+        return cxt.array_sort(bv_sort(64), cells);
+    }
+
+    /* What a cell of region holds in a fresh object */
+    z3::expr zero_cell(Region const& region) {
+        z3::expr zero = bv_val(0, region.width);
+        return region.array ? z3::const_array(bv_sort(32), zero) : zero;
+    }
+
+    /* What v is known as so far, without making up a symbol for it */
+    Optional<z3::expr> lookup_expr(Value const* v) {
+        if (unsigned int const* id = renamed.lookup(v)) {
+            return bv_constant(*id, width_of(v->getType()));
+        }
+        auto def = defs.find(v);
+        if (def != defs.end()) return def->second;
+        auto it = val2id.find(v);
+        if (it == val2id.end()) return None;
+        return cxt.constant(cxt.int_symbol(it->second), bv_sort(width_of(v->getType())));
+    }
+
     void add(z3::expr e) {
+        if (check_scopes == 0 && !active.empty()) {
+            Frame& frame = *active.back();
+            frame.assertions.push_back(e);
+            if (config.incremental) {
+                solver.add(z3::implies(*frame.literal, e));
+                ++frame.asserted;
+                return;
+            }
+        } else if (check_scopes > 0) {
+            scoped.push_back(e);
+            if (config.incremental) {
+                solver.add(z3::implies(check_literals.back(), e));
+                return;
+            }
+        }
         solver.add(e);
     }
 
+    /* Checks the active path, plus any open check scopes */
     z3::check_result check(void){
-        return solver.check();
+        cached_model = None;
+        sliced = false;
+        unknown_reason.clear();
+        refuted = None;
+        if (config.prepass) {
+            if (Optional<z3::check_result> decided = prepass_decide()) {
+                DEBUG(dbgs() << "Query decided by intervals\n");
+                if (*decided == z3::sat) {
+                    for (auto const& frame : active) {
+                        frame->checked = frame->assertions.size();
+                    }
+                    sliced = true;
+                }
+                return *decided;
+            }
+        }
+        if (cores && cores->forbids(current_query(nullptr))) {
+            DEBUG(dbgs() << "Query contains a learned unsat core\n");
+            return z3::unsat;
+        }
+        z3::check_result result = config.slice ? check_sliced() : check_whole();
+        if (result == z3::sat) {
+            for (auto const& frame : active) {
+                frame->checked = frame->assertions.size();
+            }
+        }
+        if (refuted && check_scopes == 0) {
+            // The path itself is infeasible: remember why, for its siblings
+            cores->learn(cxt, *refuted, limits());
+        }
+        return result;
+    }
+
+    /* Brings the prepass's facts up to the active path's checked
+     * assertions, then has it decide the rest. The facts only grow while
+     * the path does; on any other path they are rebuilt. */
+    Optional<z3::check_result> prepass_decide(void) {
+        size_t kept = 0;
+        while (kept < prepass_basis.size() && kept < active.size()
+               && prepass_basis[kept].first == active[kept]
+               && prepass_basis[kept].second <= active[kept]->checked) {
+            ++kept;
+        }
+        if (kept < prepass_basis.size()) {
+            prepass.clear();
+            prepass_basis.clear();
+        }
+        std::vector<z3::expr> fresh;
+        for (size_t j = 0; j < active.size(); ++j) {
+            Frame const& frame = *active[j];
+            if (j == prepass_basis.size()) prepass_basis.emplace_back(active[j], 0);
+            for (size_t i = prepass_basis[j].second; i < frame.checked; ++i) {
+                prepass.add_fact(frame.assertions[i]);
+            }
+            prepass_basis[j].second = frame.checked;
+            fresh.insert(fresh.end(), frame.assertions.begin() + frame.checked, frame.assertions.end());
+        }
+        fresh.insert(fresh.end(), scoped.begin(), scoped.end());
+        return prepass.decide(fresh);
+    }
+
+    z3::check_result check_whole(void) {
+        if (!cache) {
+            z3::check_result result = solve_path();
+            if (result == z3::unsat && cores) refuted = current_query(nullptr);
+            return result;
+        }
+        Query query = current_query(nullptr);
+        if (Optional<CachedResult> hit = cache->lookup(query)) {
+            DEBUG(dbgs() << "Query answered from cache\n");
+            cached_model = hit->model;
+            return hit->result;
+        }
+        CachedResult result{solve_path(), None};
+        if (result.result == z3::sat) {
+            result.model = cached_model ? *cached_model : solver.get_model();
+        }
+        if (result.result == z3::unsat && cores) refuted = query;
+        cache->insert(std::move(query), std::move(result));
+        return result.result;
+    }
+
+    /* Checks each independent group of constraints that something new
+     * touches on its own, with a solver of its own */
+    z3::check_result check_sliced(void) {
+        std::vector<bool> fresh;
+        Query whole = current_query(&fresh);
+        z3::check_result result = z3::sat;
+        for (Query& part : slicer.slice(whole.constraints, fresh)) {
+            Optional<CachedResult> hit;
+            if (cache) hit = cache->lookup(part);
+            if (!hit) {
+                hit = solve_apart(part.constraints);
+                if (cache) cache->insert(part, *hit);
+                if (hit->result == z3::unsat && cores) refuted = part;
+            }
+            if (hit->result == z3::unsat) return z3::unsat;
+            if (hit->result == z3::unknown) result = z3::unknown;
+        }
+        sliced = true;
+        return result;
+    }
+
+    /* The constraints check() would send to z3. If fresh isn't null, it
+     * gets whether each constraint is new since the path was last checked. */
+    Query current_query(std::vector<bool>* fresh) {
+        Query query;
+        for (auto const& frame : active) {
+            for (size_t i = 0; i < frame->assertions.size(); ++i) {
+                query.constraints.push_back(frame->assertions[i]);
+                if (fresh) fresh->push_back(i >= frame->checked);
+            }
+        }
+        for (z3::expr const& e : scoped) {
+            query.constraints.push_back(e);
+            if (fresh) fresh->push_back(true);
+        }
+        query.seal(cxt);
+        return query;
+    }
+
+    /* Solves the active path, racing strategies with config.portfolio.
+     * A raced model is left in cached_model. */
+    z3::check_result solve_path(void) {
+        if (abstraction) {
+            if (Optional<CachedResult> result = try_abstract(current_query(nullptr).constraints)) {
+                cached_model = result->model;
+                return result->result;
+            }
+        }
+        if (!portfolio) return solve();
+        CachedResult result = portfolio->check(current_query(nullptr).constraints,
+                                               query_timeout(), config.query_rlimit);
+        if (result.result == z3::unknown) unknown_reason = portfolio->reason_unknown();
+        cached_model = result.model;
+        return result.result;
+    }
+
+    /* Solves constraints away from the path solver */
+    CachedResult solve_apart(std::vector<z3::expr> const& constraints) {
+        if (abstraction) {
+            if (Optional<CachedResult> result = try_abstract(constraints)) return *result;
+        }
+        if (portfolio) {
+            CachedResult result = portfolio->check(constraints, query_timeout(), config.query_rlimit);
+            if (result.result == z3::unknown) unknown_reason = portfolio->reason_unknown();
+            return result;
+        }
+        z3::solver side(cxt, "QF_BV");
+        side.set(limits());
+        for (z3::expr const& e : constraints) {
+            side.add(e);
+        }
+        CachedResult result{side.check(), None};
+        if (result.result == z3::sat) result.model = side.get_model();
+        if (result.result == z3::unknown) unknown_reason = side.reason_unknown();
+        return result;
+    }
+
+    /* The answer over the integers, if that settles it in time */
+    Optional<CachedResult> try_abstract(std::vector<z3::expr> const& constraints) {
+        unsigned int timeout = query_timeout();
+        if (!timeout || config.abstract_timeout < timeout) timeout = config.abstract_timeout;
+        return abstraction->check(constraints, timeout);
+    }
+
+    z3::check_result solve(void) {
+        solver.set(limits());
+        z3::check_result result;
+        if (!config.incremental) {
+            result = solver.check();
+        } else {
+            z3::expr_vector assumptions(cxt);
+            for (auto const& frame : active) {
+                assumptions.push_back(*frame->literal);
+            }
+            for (z3::expr const& literal : check_literals) {
+                assumptions.push_back(literal);
+            }
+            result = solver.check(assumptions);
+        }
+        if (result == z3::unknown) unknown_reason = solver.reason_unknown();
+        return result;
+    }
+
+    /* The timeout for the next query in milliseconds (0 = none): the
+     * configured one, cut short if the deadline is nearer */
+    unsigned int query_timeout(void) const {
+        unsigned int timeout = config.query_timeout;
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            unsigned int until_deadline = left > 1 ? (unsigned int) std::min<long long>(left, UINT_MAX) : 1;
+            if (!timeout || until_deadline < timeout) timeout = until_deadline;
+        }
+        return timeout;
+    }
+
+    /* The solver parameters for the next query */
+    z3::params limits(void) {
+        z3::params params(cxt);
+        unsigned int timeout = query_timeout();
+        if (timeout) params.set("timeout", timeout);
+        if (config.query_rlimit) params.set("rlimit", config.query_rlimit);
+        return params;
+    }
+
+    /* Why the last check came back unknown, in a word where possible */
+    std::string reason_unknown(void) const {
+        if (unknown_reason.find("timeout") != std::string::npos
+            || unknown_reason.find("canceled") != std::string::npos) {
+            return "timeout";
+        }
+        if (unknown_reason.find("resource") != std::string::npos) return "resource limit";
+        if (unknown_reason.find("memory") != std::string::npos) return "memory limit";
+        return unknown_reason.empty() ? "no reason given" : unknown_reason;
     }
 
     z3::model get_model(void) {
+        if (sliced) {
+            // Counterexamples need values for the whole path
+            z3::check_result result = solve_path();
+            assert(result != z3::unsat && "independent groups were sat but the path isn't");
+            if (result != z3::sat) {
+                throw StopZ0("Counterexample could not be rebuilt: unknown (" + reason_unknown() + ")");
+            }
+            sliced = false;
+        }
+        if (cached_model) return *cached_model;
         return solver.get_model();
     }
 
@@ -161,10 +913,37 @@ public:
     }
 
     void reset(void) {
+        /* Symbols are numbered per function, so a function is encoded the
+         * same way no matter which functions this state checked before */
+        count = 0;
+        val2id.clear();
+        defs.clear();
+        reprs.clear();
+        constants.clear();
         solver.reset();
-        n2vstack.clear();
+        active.clear();
+        prepass.clear();
+        prepass_basis.clear();
+        check_scopes = 0;
+        check_literals.clear();
+        literal_count = 0;
+        frame_literals.clear();
+        live_literals = 0;
+        defined.clear();
+        scoped.clear();
+        scope_marks.clear();
+        cached_model = None;
+        sliced = false;
+        unknown_reason.clear();
+        deadline = std::chrono::steady_clock::time_point::max();
+        slicer.clear();
+        if (cache) cache->clear();
+        if (portfolio) portfolio->reset();
+        if (cores) cores->clear();
+        refuted = None;
         name2val.clear();
-        bbstack.clear();
+        renamed.clear();
+        heap = Heap();
     }
 };
 
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using namespace llvm;
+
+/* A counter printed by -z0-stats. Like LLVM's STATISTIC, but always compiled
+ * in (release builds of LLVM leave theirs out), and safe to bump from the
+ * checking threads. Counts are per module: each Z0 run that prints them
+ * starts them from zero. */
+class Z0Statistic final {
+    char const* const name;
+    char const* const desc;
+    std::atomic<uint64_t> value{0};
+
+    static std::vector<Z0Statistic*>& all(void) {
+        static std::vector<Z0Statistic*> stats;
+        return stats;
+    }
+
+public:
+    Z0Statistic(char const* name, char const* desc) : name(name), desc(desc) {
+        all().push_back(this);
+    }
+
+    Z0Statistic& operator++() {
+        value.fetch_add(1, std::memory_order_relaxed);
+        return *this;
+    }
+    Z0Statistic& operator+=(uint64_t n) {
+        value.fetch_add(n, std::memory_order_relaxed);
+        return *this;
+    }
+    uint64_t get(void) const { return value.load(std::memory_order_relaxed); }
+
+    /* Held by a run that counts, so modules checked at once (the native
+     * driver's batch and server modes) don't count into each other's */
+    static std::mutex& counting(void) {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static void reset_all(void) {
+        for (Z0Statistic* stat : all()) {
+            stat->value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static void print_all(raw_ostream& os) {
+        os << "=== Z0 statistics ===\n";
+        for (Z0Statistic const* stat : all()) {
+            os.indent(2) << stat->get() << " " << stat->name << " - " << stat->desc << "\n";
+        }
+    }
+};
+
+/* Declares a counter wherever it's used; the one translation unit that
+ * defines Z0_DEFINE_STATISTICS (before any include) defines them all */
+#ifdef Z0_DEFINE_STATISTICS
+#define Z0_STATISTIC(var, desc) Z0Statistic var(#var, desc)
+#else
+#define Z0_STATISTIC(var, desc) extern Z0Statistic var
+#endif
@@ -0,0 +1,369 @@
+#pragma once
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "heap.h"
+#include "plan.h"
+#include "proofs.h"
+#include "report.h"
+#include "stats.h"
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+
+Z0_STATISTIC(NumResultCacheHits, "Functions whose results came from the result cache");
+Z0_STATISTIC(NumResultCacheMisses, "Functions the result cache had no results for");
+
+/* Heads every stored result, and goes into every key. Bump it whenever a
+ * change to Z0 changes what checking a function can come to (or how
+ * results are stored), so results from before are never replayed. */
+static char const* const ResultFormat = "z0-result-2";
+
+/* Writes out a function's structure: everything checking it reads, with
+ * values numbered within the function, so that nothing elsewhere in the
+ * module (the numbering of metadata or of string constants) changes it.
+ * Debug locations are left out, since Z0 never prints them; the names of
+ * source variables, which it does print, are kept. */
+class Canonical final {
+    raw_ostream& os;
+    std::unordered_map<Value const*, unsigned> local;
+
+    void operand(Value const* v) {
+        auto it = local.find(v);
+        if (it != local.end()) {
+            os << '%' << it->second;
+        } else if (Function const* f = dyn_cast<Function>(v)) {
+            os << '@' << f->getName();
+        } else if (GlobalVariable const* g = dyn_cast<GlobalVariable>(v)) {
+            os << "@{";
+            if (g->hasInitializer()) operand(g->getInitializer());
+            os << '}';
+        } else if (ConstantExpr const* ce = dyn_cast<ConstantExpr>(v)) {
+            os << ce->getOpcodeName() << '(';
+            for (Value const* op : ce->operand_values()) {
+                operand(op);
+                os << ',';
+            }
+            os << ')';
+        } else if (MetadataAsValue const* md = dyn_cast<MetadataAsValue>(v)) {
+            metadata(md->getMetadata());
+        } else if (Constant const* c = dyn_cast<Constant>(v)) {
+            c->print(os);
+        } else {
+            os << '?';
+        }
+    }
+
+    void metadata(Metadata const* md) {
+        if (ValueAsMetadata const* value = dyn_cast<ValueAsMetadata>(md)) {
+            os << "!(";
+            operand(value->getValue());
+            os << ')';
+        } else if (DILocalVariable const* var = dyn_cast<DILocalVariable>(md)) {
+            os << "!var(" << var->getName() << ',' << var->getArg() << ')';
+        } else if (DIExpression const* expr = dyn_cast<DIExpression>(md)) {
+            os << "!expr(";
+            for (uint64_t e : expr->getElements()) {
+                os << e << ',';
+            }
+            os << ')';
+        } else {
+            os << "!?";
+        }
+    }
+
+public:
+    explicit Canonical(raw_ostream& os) : os(os) {}
+
+    void function(Function const& F) {
+        local.clear();
+        for (Argument const& arg : F.args()) {
+            local.emplace(&arg, local.size());
+        }
+        for (BasicBlock const& BB : F) {
+            local.emplace(&BB, local.size());
+            for (Instruction const& I : BB) {
+                local.emplace(&I, local.size());
+            }
+        }
+        os << F.getName() << ' ' << type_name(F.getFunctionType()) << '\n';
+        for (BasicBlock const& BB : F) {
+            os << "block\n";
+            for (Instruction const& I : BB) {
+                os << I.getOpcodeName();
+                if (!I.getType()->isVoidTy()) os << ' ' << type_name(I.getType());
+                if (CmpInst const* cmp = dyn_cast<CmpInst>(&I)) os << " p" << cmp->getPredicate();
+                if (AllocaInst const* a = dyn_cast<AllocaInst>(&I)) os << ' ' << type_name(a->getAllocatedType());
+                if (GEPOperator const* gep = dyn_cast<GEPOperator>(&I)) {
+                    os << ' ' << type_name(gep->getSourceElementType());
+                }
+                for (Value const* op : I.operand_values()) {
+                    os << ' ';
+                    operand(op);
+                }
+                if (PHINode const* phi = dyn_cast<PHINode>(&I)) {
+                    for (BasicBlock const* from : phi->blocks()) {
+                        os << " from ";
+                        operand(from);
+                    }
+                }
+                os << '\n';
+            }
+        }
+    }
+};
+
+/* Results of checking functions, kept on disk (in a directory of their own,
+ * unless that is "") across runs, and in memory for as long as the process
+ * lives. Results are
+ * keyed by a hash of everything they depend on: the function's IR, that of
+ * the functions it calls (whose contracts it is checked against), what
+ * those calls may write, Z0's options, and the versions of Z0 and z3. Only
+ * results that don't depend on how long checking took are stored: a run
+ * stopped by a budget, or by a z3 error, is checked again next time.
+ */
+class ResultStore final {
+    std::string const dir;
+    std::mutex lock;
+    std::unordered_map<std::string, std::string> memory; // entry by key
+
+    explicit ResultStore(std::string dir) : dir(std::move(dir)) {}
+
+    /* Entries are length-prefixed fields: numbers end in a space, and
+     * strings are their length followed by their bytes */
+    static void put(std::string& out, uint64_t n) {
+        out += std::to_string(n);
+        out += ' ';
+    }
+    static void put(std::string& out, StringRef s) {
+        put(out, s.size());
+        out.append(s.data(), s.size());
+    }
+    static bool get(StringRef& in, uint64_t& n) {
+        size_t i = 0;
+        n = 0;
+        while (i < in.size() && in[i] >= '0' && in[i] <= '9') {
+            n = n * 10 + (in[i++] - '0');
+        }
+        if (i == 0 || i >= in.size() || in[i] != ' ') return false;
+        in = in.drop_front(i + 1);
+        return true;
+    }
+    static bool get(StringRef& in, std::string& s) {
+        uint64_t n;
+        if (!get(in, n) || n > in.size()) return false;
+        s = in.substr(0, n).str();
+        in = in.drop_front(n);
+        return true;
+    }
+
+    /* Instructions by their position in F, which is how refuted checks are stored */
+    static std::vector<Instruction const*> numbered(Function const& F) {
+        std::vector<Instruction const*> insts;
+        for (BasicBlock const& BB : F) {
+            for (Instruction const& I : BB) {
+                insts.push_back(&I);
+            }
+        }
+        return insts;
+    }
+
+    std::string path(std::string const& key) const {
+        SmallString<128> file(dir);
+        sys::path::append(file, key + ".z0");
+        return file.str().str();
+    }
+
+public:
+    /* The store kept in dir, shared by every run of Z0 in this process */
+    static ResultStore& at(std::string const& dir) {
+        static std::mutex stores_lock;
+        static std::map<std::string, std::unique_ptr<ResultStore>> stores;
+        std::lock_guard<std::mutex> guard(stores_lock);
+        std::unique_ptr<ResultStore>& store = stores[dir];
+        if (!store) store.reset(new ResultStore(dir));
+        return *store;
+    }
+
+    /* The key for F's results. With `deep` (functions are run, not just
+     * checked against their callees' contracts), every function F calls,
+     * however indirectly, counts. */
+    static std::string key(Function const& F, Summaries const& summaries,
+                           std::string const& version, bool deep) {
+        std::string text;
+        raw_string_ostream os(text);
+        os << version << '\n';
+        Canonical canonical(os);
+        canonical.function(F);
+        std::set<Function const*> seen{&F};
+        std::vector<Function const*> pending{&F};
+        while (!pending.empty()) {
+            Function const* caller = pending.back();
+            pending.pop_back();
+            auto found = summaries.find(caller);
+            if (found == summaries.end()) continue;
+            for (Function const* callee : found->second.callees) {
+                if (!seen.insert(callee).second) continue;
+                if (deep) pending.push_back(callee);
+                os << "calls\n";
+                canonical.function(*callee);
+                auto writes = summaries.find(callee);
+                if (writes == summaries.end()) continue;
+                for (auto const& region : writes->second.writes) {
+                    os << "writes " << region.first << '\n';
+                }
+            }
+        }
+        MD5 hash;
+        hash.update(os.str());
+        MD5::MD5Result digest;
+        hash.final(digest);
+        SmallString<32> hex;
+        MD5::stringifyResult(digest, hex);
+        return hex.str().str();
+    }
+
+    /* Fills in report and proofs from the results stored under key, if any */
+    bool load(std::string const& key, Function const& F, FunctionReport& report, ProofLog& proofs) {
+        std::string entry;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = memory.find(key);
+            if (it != memory.end()) entry = it->second;
+        }
+        if (entry.empty() && dir.empty()) {
+            ++NumResultCacheMisses;
+            return false;
+        }
+        if (entry.empty()) {
+            ErrorOr<std::unique_ptr<MemoryBuffer>> file = MemoryBuffer::getFile(path(key));
+            if (!file) {
+                ++NumResultCacheMisses;
+                return false;
+            }
+            entry = (*file)->getBuffer().str();
+        }
+        StringRef in = entry;
+        std::vector<Instruction const*> insts = numbered(F);
+        std::string magic;
+        uint64_t bounded, complete, count, n;
+        if (!get(in, magic) || magic != ResultFormat || !get(in, bounded) || !get(in, complete)) {
+            ++NumResultCacheMisses;
+            return false;
+        }
+        FunctionReport restored;
+        std::vector<Instruction const*> refuted;
+        bool ok = get(in, count);
+        for (uint64_t i = 0; ok && i < count; ++i) {
+            ok = get(in, n) && n < insts.size();
+            if (ok) refuted.push_back(insts[n]);
+        }
+        ok = ok && get(in, count);
+        for (uint64_t i = 0; ok && i < count; ++i) {
+            FunctionReport::Chunk chunk;
+            ok = get(in, n) && get(in, chunk.text);
+            chunk.is_err = n;
+            restored.chunks.push_back(std::move(chunk));
+        }
+        ok = ok && get(in, count);
+        for (uint64_t i = 0; ok && i < count; ++i) {
+            uint64_t kind, values;
+            Finding finding;
+            ok = get(in, kind) && kind <= Finding::Error && get(in, finding.what) && get(in, values);
+            finding.kind = Finding::Kind(kind);
+            for (uint64_t v = 0; ok && v < values; ++v) {
+                std::pair<std::string, std::string> value;
+                ok = get(in, value.first) && get(in, value.second);
+                finding.values.push_back(std::move(value));
+            }
+            restored.findings.push_back(std::move(finding));
+        }
+        if (!ok || !in.empty()) {
+            ++NumResultCacheMisses;
+            return false;
+        }
+        ++NumResultCacheHits;
+        report.absorb(restored);
+        if (bounded) report.set_bounded();
+        report.cached = true;
+        for (Instruction const* inst : refuted) {
+            proofs.refute(inst);
+        }
+        if (complete) proofs.finish();
+        std::lock_guard<std::mutex> guard(lock);
+        memory.emplace(key, std::move(entry));
+        return true;
+    }
+
+    /* Stores what checking F came to under key, unless it depended on time
+     * or resource limits (see FunctionReport::set_limited) */
+    void save(std::string const& key, Function const& F, FunctionReport const& report,
+              ProofLog const& proofs) {
+        Verdict verdict = report.result().verdict;
+        if (verdict == Verdict::Stopped || verdict == Verdict::Error || report.limited) return;
+        std::string entry;
+        put(entry, ResultFormat);
+        put(entry, report.bounded);
+        put(entry, proofs.finished());
+        std::vector<uint64_t> refuted;
+        std::vector<Instruction const*> insts = numbered(F);
+        for (size_t i = 0; i < insts.size(); ++i) {
+            if (proofs.refuted_at(insts[i])) refuted.push_back(i);
+        }
+        put(entry, refuted.size());
+        for (uint64_t i : refuted) {
+            put(entry, i);
+        }
+        put(entry, report.chunks.size());
+        for (FunctionReport::Chunk const& chunk : report.chunks) {
+            put(entry, chunk.is_err);
+            put(entry, chunk.text);
+        }
+        put(entry, report.findings.size());
+        for (Finding const& finding : report.findings) {
+            put(entry, finding.kind);
+            put(entry, finding.what);
+            put(entry, finding.values.size());
+            for (auto const& value : finding.values) {
+                put(entry, value.first);
+                put(entry, value.second);
+            }
+        }
+
+        if (!dir.empty()) write(key, entry);
+        std::lock_guard<std::mutex> guard(lock);
+        memory[key] = std::move(entry);
+    }
+
+private:
+    /* Written aside and renamed into place, so no run reads half an entry */
+    void write(std::string const& key, std::string const& entry) {
+        SmallString<128> temp;
+        int fd;
+        if (sys::fs::create_directories(dir)
+            || sys::fs::createUniqueFile(dir + "/%%%%%%%%.tmp", fd, temp)) {
+            return; // a cache we can't write to is only a slower one
+        }
+        {
+            raw_fd_ostream os(fd, true);
+            os << entry;
+        }
+        if (sys::fs::rename(temp, path(key))) sys::fs::remove(temp);
+    }
+};
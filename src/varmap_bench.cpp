@@ -0,0 +1,80 @@
+/* Microbenchmark: copying the variable map at every branch, as Z0 does for
+ * each path it forks, with std::map versus PersistentMap.
+ *
+ *   make varmap_bench && ./varmap_bench [variables] [depth]
+ *
+ * Explores a full binary tree of branches `depth` deep. Every block assigns
+ * one variable, and every branch copies the map for both successors.
+ */
+#include "llvm/ADT/StringRef.h"
+#include "pmap.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+struct Info { unsigned block; };
+
+static std::vector<std::string> names;
+static unsigned long checksum;
+
+template <typename Map>
+static void assign(Map& m, StringRef name, unsigned block);
+
+template <>
+void assign(std::map<StringRef, Info>& m, StringRef name, unsigned block) {
+    m[name] = Info{block};
+}
+
+template <>
+void assign(PersistentMap<StringRef, Info>& m, StringRef name, unsigned block) {
+    m.set(name, Info{block});
+}
+
+template <typename Map>
+static void explore(Map vars, unsigned block, unsigned depth) {
+    assign(vars, names[block % names.size()], block);
+    if (depth == 0) {
+        checksum += vars.size();
+        return;
+    }
+    explore(vars, 2 * block + 1, depth - 1); // copies for each successor
+    explore(vars, 2 * block + 2, depth - 1);
+}
+
+template <typename Map>
+static double run(unsigned variables, unsigned depth) {
+    Map vars;
+    for (unsigned i = 0; i < variables; ++i) {
+        assign(vars, names[i], 0);
+    }
+    checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    explore(vars, 0, depth);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    unsigned variables = argc > 1 ? atoi(argv[1]) : 200;
+    unsigned depth = argc > 2 ? atoi(argv[2]) : 16;
+    for (unsigned i = 0; i < variables; ++i) {
+        names.push_back("_c0v_var" + std::to_string(i));
+    }
+    double copied = run<std::map<StringRef, Info>>(variables, depth);
+    unsigned long expected = checksum;
+    double shared = run<PersistentMap<StringRef, Info>>(variables, depth);
+    if (checksum != expected) {
+        printf("checksums differ: %lu vs %lu\n", expected, checksum);
+        return 1;
+    }
+    printf("%u variables, %u paths of %u blocks\n", variables, 1u << depth, depth + 1);
+    printf("std::map:      %.3fs\n", copied);
+    printf("PersistentMap: %.3fs (%.1fx)\n", shared, copied / shared);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "llvm/IR/BasicBlock.h"
+#include "state.h"
+#include "report.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+
+enum class SearchStrategy { DFS, BFS, Priority };
+
+/* How the checker explores paths, and when it gives up */
+struct SearchConfig final {
+    SearchStrategy strategy = SearchStrategy::DFS;
+    unsigned max_paths = 0;   // 0 = unlimited
+    unsigned max_depth = 0;   // blocks along one path, 0 = unlimited
+    unsigned time_budget = 0; // seconds per function, 0 = unlimited
+    unsigned max_unroll = 0;  // unroll loops without invariants this far, 0 = cut them
+    unsigned concrete_runs = 0; // inputs to run each function on first, 0 = none
+    SolverConfig solver;      // how each path's queries are posed
+    /* When the whole module's time is up */
+    std::chrono::steady_clock::time_point module_deadline = std::chrono::steady_clock::time_point::max();
+    /* Set by whoever asked for the check once they no longer want it */
+    std::atomic<bool> const* cancelled = nullptr;
+};
+
+/* Limits shared by everything exploring one function (on any thread) */
+class SearchBudget final {
+    std::chrono::steady_clock::time_point const until;
+    std::atomic<unsigned> paths{0};
+
+    static std::chrono::steady_clock::time_point
+    deadline_for(SearchConfig const& config) {
+        if (!config.time_budget) return config.module_deadline;
+        auto own = std::chrono::steady_clock::now() + std::chrono::seconds(config.time_budget);
+        return std::min(own, config.module_deadline);
+    }
+
+public:
+    SearchConfig const config;
+
+    explicit SearchBudget(SearchConfig const& config)
+        : until(deadline_for(config)), config(config) {}
+
+    /* When this function's time (or the module's) is up */
+    std::chrono::steady_clock::time_point deadline(void) const { return until; }
+
+    bool out_of_time(void) const {
+        return until != std::chrono::steady_clock::time_point::max()
+            && std::chrono::steady_clock::now() > until;
+    }
+
+    bool cancelled(void) const {
+        return config.cancelled && config.cancelled->load(std::memory_order_relaxed);
+    }
+
+    void finish_path(void) { ++paths; }
+    bool out_of_paths(void) const {
+        return config.max_paths && paths >= config.max_paths;
+    }
+    bool too_deep(unsigned depth) const {
+        return config.max_depth && depth > config.max_depth;
+    }
+};
+
+/* One path being explored: where it is, and everything known along it */
+struct PathState final {
+    BasicBlock const* block;               // next block to run
+    BasicBlock const* from;                // predecessor, for PHI nodes
+    bool phis_done;                        // block's PHIs were assigned by a merge
+    bool needs_check;                      // path condition not yet known satisfiable
+    std::shared_ptr<Frame> frame;          // assertions along the path
+    VarMap name2val;
+    Renames renamed;                       // values given fresh symbols on this path
+    Heap heap;                             // regions stored to and objects allocated
+    PathKey key;                           // DFS position (for ordering output)
+    unsigned depth;                        // blocks run so far
+    Trips trips;                           // times round each unrolled loop
+};
+
+/* The paths still to be explored, in the order the search strategy wants.
+ * DFS pops the newest path, BFS the oldest, and Priority the path whose block
+ * is closest to a check no path has reached yet (ties go to the newest). */
+class Worklist final {
+    using Score = std::function<unsigned(PathState const&)>;
+
+    struct Entry {
+        unsigned score;
+        unsigned long seq;
+        PathState state;
+    };
+    /* Orders the heap so the best (lowest score, then newest) entry is on top */
+    struct Worse {
+        bool operator()(Entry const& a, Entry const& b) const {
+            return a.score != b.score ? a.score > b.score : a.seq < b.seq;
+        }
+    };
+
+    SearchStrategy const strategy;
+    Score const score;
+    std::deque<PathState> states;   // DFS and BFS
+    std::vector<Entry> heap;        // Priority
+    unsigned long seq = 0;
+
+public:
+    Worklist(SearchStrategy strategy, Score score)
+        : strategy(strategy), score(std::move(score)) {}
+
+    bool empty(void) const {
+        return states.empty() && heap.empty();
+    }
+
+    size_t size(void) const {
+        return states.size() + heap.size();
+    }
+
+    void push(PathState&& state) {
+        if (strategy == SearchStrategy::Priority) {
+            unsigned s = score(state);
+            heap.push_back(Entry{s, seq++, std::move(state)});
+            std::push_heap(heap.begin(), heap.end(), Worse());
+        } else {
+            states.push_back(std::move(state));
+        }
+    }
+
+    PathState pop(void) {
+        switch (strategy) {
+            case SearchStrategy::DFS: {
+                PathState state = std::move(states.back());
+                states.pop_back();
+                return state;
+            }
+            case SearchStrategy::BFS: {
+                PathState state = std::move(states.front());
+                states.pop_front();
+                return state;
+            }
+            case SearchStrategy::Priority:
+                /* Scores only get worse as checks get covered, so rescore
+                 * the top entry until it is still the best one */
+                while (true) {
+                    std::pop_heap(heap.begin(), heap.end(), Worse());
+                    Entry& top = heap.back();
+                    unsigned now = score(top.state);
+                    if (now == top.score || heap.size() == 1
+                        || now <= heap.front().score) {
+                        PathState state = std::move(top.state);
+                        heap.pop_back();
+                        return state;
+                    }
+                    top.score = now;
+                    std::push_heap(heap.begin(), heap.end(), Worse());
+                }
+        }
+        __builtin_unreachable();
+    }
+};
@@ -1,11 +1,15 @@
+#define Z0_DEFINE_STATISTICS
 #include "z0.h"
 
 #define DEBUG_TYPE "Z0"
 
+/* Prints the values the model gives the source variables, and records
+ * them as a counterexample to what */
 void
-Z0::display_counterexample(void) {
+Z0Checker::display_counterexample(std::string const& what) {
     z3::model model = state.get_model();
-    outs() << "=== Counterexample: ===\n";
+    out() << "=== Counterexample: ===\n";
+    Finding& finding = report->find(Finding::Counterexample, what);
     DEBUG(dbgs() << "Outputting model:\n");
     DEBUG(dbgs() << to_string(model) << "\n");
     DEBUG(dbgs() << "From Assertions:\n");
@@ -29,95 +33,318 @@ Z0::display_counterexample(void) {
     for (auto& pair : state.name2val) {
         // DEBUG(dbgs() << "looking at variable " << pair.first << "\n");
         StringRef localname = pair.first;
+        std::string name;
         if (localname.startswith("_c0v_")) {
-            outs() << "int " << localname.drop_front(5) << " = ";
+            name = localname.drop_front(5).str();
+            out() << "int " << name << " = ";
         } else if (localname == "_c0t__result") {
-            outs() << "\\result = ";
+            name = "\\result";
+            out() << name << " = ";
         } else {
             assert(false && "weird variable name??");
         }
-        Value const* val = pair.second.second->getValue();
-        if (z3::symbol* symb = state.lookup_symbol(val)) {
-            auto it = symb2num.find(*symb);
-            if (it == symb2num.end()) {
-                outs() << to_string(*symb) << "?\n";
-            } else {
-                outs() << it->second << "\n";
-            }
-        } else if (auto const* intval = llvm::dyn_cast<ConstantInt>(val)) {
-            outs() << intval->getSExtValue() << "\n";
+        std::string shown = "*";
+        if (pair.second.merged_id) {
+            auto it = symb2num.find(state.cxt.int_symbol(pair.second.merged_id));
+            if (it != symb2num.end()) shown = std::to_string(it->second);
         } else {
-            outs() << "*\n";
+            Value const* val = pair.second.val->getValue();
+            Optional<z3::expr> expr;
+            if (isa<IntegerType>(val->getType())) expr = state.lookup_expr(val);
+            if (expr && !expr->is_const()) {
+                // Substituted: work the value out from the symbols it's built from
+                z3::expr value = model.eval(*expr).simplify();
+                if (Z3_get_numeral_int64(state.cxt, value, &integer)) {
+                    shown = std::to_string((int) integer);
+                }
+            } else if (Optional<z3::symbol> symb = state.lookup_symbol(val)) {
+                auto it = symb2num.find(*symb);
+                shown = it == symb2num.end() ? to_string(*symb) + "?" : std::to_string(it->second);
+            } else if (auto const* intval = llvm::dyn_cast<ConstantInt>(val)) {
+                shown = std::to_string(intval->getSExtValue());
+            }
         }
+        out() << shown << "\n";
+        finding.values.emplace_back(std::move(name), std::move(shown));
     }
 }
 
-void
-Z0::analyze_z0_assert(CallInst const* ci) {
-    Value const* cond = ci->getOperand(0);
-    if (is_precondition(ci)) {
-        state.assert_eq(state.z3_repr(cond), true_expr);
-    } else { // not a precondition
-        if (!is_reachable()){
-            throw UnreachablePath();
-        }
-        DEBUG(dbgs() << "Analyzing assertion " << *ci << "\n");
-        state.push();
-        {
-            state.assert_eq(state.z3_repr(cond), false_expr);
-            switch (state.check()) {
-                case z3::sat:
-                    DEBUG(dbgs() << "Found counterexample!\n");
-                    display_counterexample();
-                    if (ci->getCalledFunction()->getName() == "z0_ensures")
-                        throw StopZ0("Found counterexample to postcondition");
-                    else if (ci->getCalledFunction()->getName() == "z0_loop_invariant")
-                        throw StopZ0("Found counterexample to loop invariant");
-                    else
-                        throw StopZ0("Found counterexample to assertion");
-                case z3::unsat:
-                    DEBUG(dbgs() << "Assertion verified!:\n");
-                    DEBUG(dbgs() << to_string(state.solver.assertions()));
-                    break;
-                case z3::unknown:
-                    errs() << "Assertion could not be verified!\n"; break;
-            }
-        }
-        state.pop();
-        /* We add the assertion in case we couldn't derive it */
-        state.assert_eq(state.z3_repr(cond), true_expr);
+Status
+Z0Checker::analyze_z0_assert(CallInst const* ci) {
+    if (is_precondition(ci) || plan->invariants.count(ci)) {
+        // Invariants of cut loops were checked when the loop was entered
+        state.assert_eq(state.z3_repr(ci->getOperand(0)), true_expr);
+        return Status::Ok;
+    }
+    return check_assertion(ci);
+}
+
+Status
+Z0Checker::check_assertion(CallInst const* ci) {
+    if (!is_reachable()){
+        return Status::Infeasible;
+    }
+    covered.insert(ci);
+    DEBUG(dbgs() << "Analyzing assertion " << *ci << "\n");
+    StringRef name = ci->getCalledFunction()->getName();
+    z3::expr cond = state.z3_repr(ci->getOperand(0));
+    if (name == "z0_ensures") return check_condition(ci, cond, "postcondition");
+    if (name == "z0_loop_invariant") return check_condition(ci, cond, "loop invariant");
+    return check_condition(ci, cond, "assertion");
+}
+
+/* Checks that cond (a 1-bit value) holds on the active path, which must be
+ * reachable, then assumes it. Unless it is proved, the check instruction
+ * stays in compiled code. */
+Status
+Z0Checker::check_condition(Instruction const* check, z3::expr cond, std::string const& what) {
+    state.push();
+    {
+        state.assert_eq(cond, false_expr);
+        switch (state.check()) {
+            case z3::sat:
+                DEBUG(dbgs() << "Found counterexample!\n");
+                proofs->refute(check);
+                display_counterexample(what);
+                state.pop();
+                stop_reason = "Found counterexample to " + what;
+                return Status::Failed;
+            case z3::unsat:
+                DEBUG(dbgs() << "Assertion verified!:\n");
+                DEBUG(dbgs() << to_string(state.solver.assertions()));
+                break;
+            case z3::unknown:
+                err() << "Assertion could not be verified! unknown (" << state.reason_unknown() << ")\n";
+                report->find(Finding::Unknown, what);
+                report->set_limited();
+                proofs->refute(check);
+                break;
+        }
+    }
+    state.pop();
+    /* We add the assertion in case we couldn't derive it */
+    state.assert_eq(cond, true_expr);
+    return Status::Ok;
+}
+
+/* Stands in for running a call to a C0 function: its preconditions are
+ * checked here, everything it may store to is havocked, and the
+ * postconditions of one of its returns assumed of the value it returns.
+ * Conditions that can't be evaluated at the call (those reading memory, say)
+ * are left out of what's assumed, with a warning. */
+Status
+Z0Checker::analyze_c0_call(CallInst const* ci) {
+    Function const* callee = ci->getCalledFunction();
+    std::string name = callee->getName().drop_front(4).str();
+    if (!plan->summaries) return Status::Ok;
+    auto found = plan->summaries->find(callee);
+    if (found == plan->summaries->end()) {
+        DEBUG(dbgs() << "No contract for " << name << ": its result could be anything\n");
+        return Status::Ok;
+    }
+    Summary const& summary = found->second;
+    ++NumCallsSummarized;
+    if (!summary.requires.empty() && !is_reachable()) return Status::Infeasible;
+    for (Value const* cond : summary.requires) {
+        ContractCall at{ci, &summary, nullptr, {}, {}, {}};
+        Optional<z3::expr> holds = contract_value(cond, at);
+        if (!holds) {
+            err() << "Warning: a precondition of " << name << " could not be checked at this call\n";
+            report->find(Finding::Unknown, "precondition of " + name);
+            proofs->refute(ci);
+            continue;
+        }
+        Status status = check_condition(ci, *holds, "precondition of " + name);
+        if (status != Status::Ok) return status;
+    }
+    havoc_memory(summary.writes);
+    // The call returned through one of the return sites: assume that one's
+    // postconditions, with what it returns, and the way there in the callee
+    BasicBlock const* entry = &callee->getEntryBlock();
+    z3::expr_vector ways(state.cxt);
+    for (ReturnSite const& site : summary.returns) {
+        if (!site.result) {
+            err() << "Warning: a postcondition of " << name << " has no return to take \\result from, "
+                  << "and is not assumed\n";
+            ways.push_back(state.cxt.bool_val(true));
+            continue;
+        }
+        ContractCall at{ci, &summary, *site.result, {}, {}, {}};
+        z3::expr way = state.cxt.bool_val(true);
+        if (Optional<z3::expr> reached = contract_guard(site.block, entry, at)) way = way && *reached;
+        if (*site.result && isa<IntegerType>(ci->getType())) {
+            if (Optional<z3::expr> returned = contract_value(*site.result, at)) {
+                way = way && state.z3_repr(ci) == *returned;
+            }
+        }
+        for (Value const* cond : site.ensures) {
+            Optional<z3::expr> holds = contract_value(cond, at);
+            if (!holds) {
+                err() << "Warning: a postcondition of " << name << " could not be assumed at this call\n";
+                continue;
+            }
+            way = way && *holds == true_expr;
+        }
+        ways.push_back(way);
+    }
+    if (!ways.empty()) state.add(z3::mk_or(ways));
+    return Status::Ok;
+}
+
+/* What v, a value in the callee, is at the call: the callee's arguments are
+ * the call's. A \result that can't be worked out from them is the call's
+ * value, which it is on the way to the return at hand. */
+Optional<z3::expr>
+Z0Checker::contract_value(Value const* v, ContractCall& at) {
+    if (!isa<IntegerType>(v->getType())) return None;
+    if (isa<ConstantInt>(v)) return state.z3_repr(v);
+    if (Argument const* arg = dyn_cast<Argument>(v)) {
+        Value const* actual = at.call->getArgOperand(arg->getArgNo());
+        if (!isa<IntegerType>(actual->getType())) return None;
+        return state.z3_repr(actual);
+    }
+    Instruction const* instr = dyn_cast<Instruction>(v);
+    if (!instr) return None;
+    auto known = at.values.find(v);
+    if (known != at.values.end()) return known->second;
+    at.values.emplace(v, None); // going round a cycle back to v gets nowhere
+    Optional<z3::expr> e = contract_instruction(instr, at);
+    if (!e && v == at.result) e = state.z3_repr(at.call);
+    at.values[v] = e;
+    return e;
+}
+
+Optional<z3::expr>
+Z0Checker::contract_instruction(Instruction const* instr, ContractCall& at) {
+    if (ICmpInst const* icmp = dyn_cast<ICmpInst>(instr)) {
+        Optional<z3::expr> a = contract_value(icmp->getOperand(0), at);
+        Optional<z3::expr> b = contract_value(icmp->getOperand(1), at);
+        if (!a || !b) return None;
+        return z3::ite(cmp_expr(icmp->getPredicate(), *a, *b), true_expr, false_expr);
+    } else if (isa<BinaryOperator>(instr)) {
+        Optional<z3::expr> a = contract_value(instr->getOperand(0), at);
+        Optional<z3::expr> b = contract_value(instr->getOperand(1), at);
+        if (!a || !b) return None;
+        return binop_expr(instr->getOpcode(), *a, *b);
+    } else if (CastInst const* icast = dyn_cast<CastInst>(instr)) {
+        Optional<z3::expr> a = contract_value(icast->getOperand(0), at);
+        if (!a || !icast->isIntegerCast()) return None;
+        return cast_expr(icast, *a);
+    } else if (CallInst const* ci = dyn_cast<CallInst>(instr)) {
+        StringRef name = ci->getCalledFunction() ? ci->getCalledFunction()->getName() : "";
+        if (name != "c0_idiv" && name != "c0_imod") return None;
+        Optional<z3::expr> a = contract_value(ci->getOperand(0), at);
+        Optional<z3::expr> b = contract_value(ci->getOperand(1), at);
+        if (!a || !b) return None;
+        return binop_expr(name == "c0_idiv" ? Instruction::SDiv : Instruction::SRem, *a, *b);
+    } else if (PHINode const* phi = dyn_cast<PHINode>(instr)) {
+        // Like merging: which incoming value depends on how control got here
+        // from the block's immediate dominator
+        auto dom = at.summary->dominators.find(phi->getParent());
+        if (dom == at.summary->dominators.end()) return None;
+        unsigned n = phi->getNumIncomingValues();
+        Optional<z3::expr> merged = contract_value(phi->getIncomingValue(n - 1), at);
+        for (unsigned i = n - 1; merged && i-- > 0; ) {
+            BasicBlock const* pred = phi->getIncomingBlock(i);
+            Optional<z3::expr> val = contract_value(phi->getIncomingValue(i), at);
+            Optional<z3::expr> reached = contract_guard(pred, dom->second, at);
+            Optional<z3::expr> taken = contract_edge(pred, phi->getParent(), at);
+            if (!val || !reached || !taken) return None;
+            merged = z3::ite(*reached && *taken, *val, *merged);
+        }
+        return merged;
+    }
+    return None;
+}
+
+/* The condition under which control goes from `from` to `to` in the callee */
+Optional<z3::expr>
+Z0Checker::contract_edge(BasicBlock const* from, BasicBlock const* to, ContractCall& at) {
+    BranchInst const* br = dyn_cast<BranchInst>(from->getTerminator());
+    if (!br) return None;
+    if (!br->isConditional() || br->getSuccessor(0) == br->getSuccessor(1)) {
+        return state.cxt.bool_val(true);
+    }
+    Optional<z3::expr> cond = contract_value(br->getCondition(), at);
+    if (!cond) return None;
+    return *cond == (to == br->getSuccessor(0) ? true_expr : false_expr);
+}
+
+/* The condition under which control gets from dom to block in the callee,
+ * dom dominating block */
+Optional<z3::expr>
+Z0Checker::contract_guard(BasicBlock const* block, BasicBlock const* dom, ContractCall& at) {
+    if (block == dom) return state.cxt.bool_val(true);
+    auto key = std::make_pair(block, dom);
+    auto known = at.guards.find(key);
+    if (known != at.guards.end()) return known->second;
+    if (!at.visiting.insert(block).second) return None; // a loop
+    Optional<z3::expr> guard;
+    z3::expr_vector ways(state.cxt);
+    std::vector<BasicBlock const*> preds;
+    bool ok = true;
+    for (BasicBlock const* pred : predecessors(block)) {
+        if (std::find(preds.begin(), preds.end(), pred) != preds.end()) continue;
+        preds.push_back(pred);
+        Optional<z3::expr> reached = contract_guard(pred, dom, at);
+        Optional<z3::expr> taken = contract_edge(pred, block, at);
+        if (!reached || !taken) { ok = false; break; }
+        ways.push_back(*reached && *taken);
     }
+    if (ok && !preds.empty()) guard = z3::mk_or(ways);
+    at.visiting.erase(block);
+    at.guards.emplace(key, guard);
+    return guard;
 }
 
+/* Reports a counterexample if `unsafe` can happen on the active path, then
+ * assumes it doesn't, the runtime having stopped the program if it did */
 void
-Z0::check_div(z3::expr a, z3::expr b) {
-    z3::expr fdiv = (b == zero_expr) || (a == int_min_expr && b == minusone_expr);
+Z0Checker::check_safe(Instruction const* check, z3::expr unsafe, char const* possible,
+                      char const* unproven) {
     state.push();
     {
-        state.add(fdiv);
+        state.add(unsafe);
         switch (state.check()) {
             case z3::sat:
-                errs() << "Division by zero possible!\n";
-                display_counterexample();
+                err() << possible << "\n";
+                proofs->refute(check);
+                display_counterexample(possible);
                 break;
             case z3::unsat:
-                DEBUG(dbgs() << "Division by zero impossible\n"); break;
+                DEBUG(dbgs() << "Impossible: " << possible << "\n"); break;
             case z3::unknown:
-                errs() << "Cannot prove division safe!\n";
-                errs() << state.solver.reason_unknown() << "\n";
+                err() << unproven << " unknown (" << state.reason_unknown() << ")\n";
+                report->find(Finding::Unknown, unproven);
+                report->set_limited();
+                proofs->refute(check);
                 break;
         }
     }
     state.pop();
-    state.add(!fdiv);
+    state.add(!unsafe);
+}
+
+void
+Z0Checker::check_div(Instruction const* check, z3::expr a, z3::expr b) {
+    check_safe(check, (b == zero_expr) || (a == int_min_expr && b == minusone_expr),
+               "Division by zero possible!", "Cannot prove division safe!");
+}
+
+/* The length facts go in first, so only arrays actually indexed get any */
+void
+Z0Checker::check_index(Instruction const* check, z3::expr array, z3::expr index) {
+    state.add(state.length_facts(array));
+    z3::expr length = state.array_length(array);
+    check_safe(check, index < zero_expr || index >= length, "Array index out of bounds possible!",
+               "Cannot prove array access in bounds!");
 }
 
 /* Implement bitvector arithmetic*/
 #define Z3_MK(name, a, b) state.z3_to_expr(Z3_mk_##name(state.cxt, a, b))
 
 z3::expr
-Z0::cast_expr(CastInst const* icast) {
-    z3::expr operand = state.z3_repr(icast->getOperand(0));
+Z0Checker::cast_expr(CastInst const* icast, z3::expr operand) {
     if (!icast->isIntegerCast()) throw StopZ0("Unknown non-integer cast");
     unsigned srcTypeWidth = cast<IntegerType>(icast->getSrcTy())->getBitWidth();
     unsigned dstTypeWidth = cast<IntegerType>(icast->getDestTy())->getBitWidth();
@@ -133,7 +360,7 @@ Z0::cast_expr(CastInst const* icast) {
 }
 
 z3::expr
-Z0::binop_expr(unsigned opcode, z3::expr a, z3::expr b) {
+Z0Checker::binop_expr(unsigned opcode, z3::expr a, z3::expr b) {
     switch (opcode) {
         case Instruction::Add:  return Z3_MK(bvadd, a, b);
         case Instruction::Sub:  return Z3_MK(bvsub, a, b);
@@ -155,7 +382,7 @@ Z0::binop_expr(unsigned opcode, z3::expr a, z3::expr b) {
 }
 
 z3::expr
-Z0::cmp_expr(llvm::CmpInst::Predicate pred, z3::expr a, z3::expr b) {
+Z0Checker::cmp_expr(llvm::CmpInst::Predicate pred, z3::expr a, z3::expr b) {
     switch (pred) {
         case llvm::CmpInst::ICMP_EQ:  return a == b;
         case llvm::CmpInst::ICMP_NE:  return a != b;
@@ -173,6 +400,501 @@ Z0::cmp_expr(llvm::CmpInst::Predicate pred, z3::expr a, z3::expr b) {
     }
 }
 #undef BV_ARITH
+
+void
+Z0Checker::check_function_parallel(Function const& F, FunctionPlan const& plan,
+                                   SearchConfig const& config, FunctionReport& report,
+                                   ProofLog& proofs, unsigned jobs) {
+    report.out() << "Analyzing function " << F.getName().drop_front(4) << "...\n";
+    if (config.concrete_runs && falsify(F, config.concrete_runs, report)) return;
+    PathPool pool(jobs);
+    SearchBudget budget(config);
+    std::atomic<bool> doesReturn(false);
+    std::atomic<unsigned> cut(0);
+    std::atomic<unsigned> deeper(0);
+    unsigned unrolled = UINT_MAX; // the least any task checked to; under results_lock
+    std::mutex results_lock;
+    std::vector<std::unique_ptr<FunctionReport>> results;
+
+    {
+        PathSnapshot root;
+        root.cxt.reset(new z3::context());
+        root.assertions.reset(new z3::expr_vector(*root.cxt));
+        root.count = 0;
+        std::unique_ptr<PathTask> task(new PathTask{std::move(root), &F.getEntryBlock(), nullptr, PathKey(), 0, {}});
+        pool.push(0, std::move(task));
+    }
+
+    auto worker = [&](unsigned me) {
+        while (std::unique_ptr<PathTask> task = pool.next(me)) {
+            std::unique_ptr<FunctionReport> output(new FunctionReport());
+            {
+                Z0Checker checker(*task, plan, budget, pool, me, *output, proofs);
+                try {
+                    ExploreResult result = checker.resume(*task);
+                    if (result.returns) doesReturn = true;
+                    cut += result.cut;
+                    if (result.deeper) {
+                        deeper += result.deeper;
+                        std::lock_guard<std::mutex> guard(results_lock);
+                        unrolled = std::min(unrolled, result.unrolled);
+                    }
+                    if (result.out_of_budget) output->set_limited();
+                    if (result.stopped) {
+                        checker.report_stop(checker.stop_reason, &F.getEntryBlock());
+                        pool.stop_at(checker.path_key);
+                    }
+                } catch (StopZ0 e) {
+                    checker.report_stop(e.why, &F.getEntryBlock());
+                    pool.stop_at(checker.path_key);
+                } catch (z3::exception e) {
+                    checker.report_internal_error(e);
+                    pool.stop_at(checker.path_key);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> guard(results_lock);
+                results.push_back(std::move(output));
+            }
+            pool.finish();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned j = 1; j < jobs; ++j) {
+        threads.emplace_back(worker, j);
+    }
+    worker(0);
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    for (auto& output : results) {
+        report.absorb(*output);
+    }
+    report.order_by_path(pool.get_stop_key());
+    if (!pool.get_stop_key()) {
+        if (cut || deeper) report.set_bounded();
+        if (cut) {
+            report.out() << "Warning: " << cut << " path(s) hit the depth limit and were not checked to the end.\n";
+        }
+        if (deeper) {
+            report.out() << "Verified up to " << unrolled << " iteration(s) of each loop; "
+                         << deeper << " path(s) go round more.\n";
+        }
+        if (!doesReturn && !cut && !deeper) {
+            report.out() << "Warning: function never returns. Perhaps an infinite loop or unsatisfiable precondition?\n";
+        }
+        report.out() << "OK!\n";
+        if (!cut && !deeper) proofs.finish();
+    }
+}
+
+bool
+Z0Checker::falsify(Function const& F, unsigned runs, FunctionReport& report) {
+    std::vector<unsigned> widths;
+    std::vector<std::vector<uint64_t>> candidates;
+    for (Argument const& arg : F.args()) {
+        widths.push_back(width_of(arg.getType()));
+        if (!widths.back()) return false;
+        candidates.push_back(ConcreteRunner::boundaries(widths.back()));
+    }
+    ConcreteRunner runner;
+    std::mt19937 rng(355); // the same inputs every time, for reproducible output
+    std::vector<size_t> digits(candidates.size(), 0); // next combination of boundaries
+    bool boundaries_left = true;
+    for (unsigned run = 0; run < runs; ++run) {
+        std::vector<uint64_t> args;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            args.push_back(boundaries_left ? candidates[i][digits[i]]
+                                           : ConcreteRunner::random_value(rng, widths[i]));
+        }
+        if (boundaries_left) {
+            size_t i = 0;
+            for (; i < digits.size() && ++digits[i] == candidates[i].size(); ++i) {
+                digits[i] = 0;
+            }
+            boundaries_left = i < digits.size();
+        }
+        ++NumConcreteRuns;
+        switch (runner.run(F, args)) {
+            case RunOutcome::Failed:
+                ++NumConcreteFalsified;
+                if (!runner.message.empty()) report.err() << runner.message << "\n";
+                report.out() << "=== Counterexample: ===\n";
+                for (auto const& shown : runner.shown) {
+                    report.out() << (shown.first == "\\result" ? "" : "int ")
+                                 << shown.first << " = " << shown.second << "\n";
+                }
+                report.find(Finding::Counterexample, runner.what).values = runner.shown;
+                report.err() << "Z0 Stopped: Found counterexample to " << runner.what << "\n";
+                return true;
+            case RunOutcome::Unsupported:
+                DEBUG(dbgs() << "Can't run " << F.getName() << " concretely\n");
+                return false;
+            default:
+                break;
+        }
+        if (candidates.empty()) break; // every run would be the same
+    }
+    return false;
+}
+
+/* Finds the branches whose paths are worth merging at their immediate
+ * post-dominator. Merging replaces 2^n paths through n diamonds with one
+ * path, but each merge makes the path condition bigger, so we only merge
+ * regions that are small, loop-free, only entered through the branch, and
+ * free of checks and calls (which would need reporting along every merged
+ * path anyway) and of loads and stores (the heap isn't merged).
+ */
+void
+Z0::plan_merges(Function const& F, PostDominatorTree& pdt, FunctionPlan& plan) {
+    for (BasicBlock const& BB : F) {
+        BranchInst const* br = dyn_cast<BranchInst>(BB.getTerminator());
+        if (!br || !br->isConditional() || br->getSuccessor(0) == br->getSuccessor(1)) {
+            continue;
+        }
+        DomTreeNode *node = pdt.getNode(const_cast<BasicBlock*>(&BB));
+        if (!node || !node->getIDom() || !node->getIDom()->getBlock()) {
+            continue; // only post-dominated by the virtual exit
+        }
+        MergeRegion region;
+        region.join = node->getIDom()->getBlock();
+        if (plan.loops.count(region.join)) {
+            continue; // arriving at a loop header merged would skip cutting it
+        }
+        if (collect_region(BB, region)) {
+            DEBUG(dbgs() << "Will merge " << region.blocks.size() << " blocks from "
+                         << BB.getName() << " to " << region.join->getName() << "\n");
+            plan.merges.emplace(&BB, std::move(region));
+        }
+    }
+}
+
+/* Collects the blocks between BB and region.join in topological order.
+ * Returns false if the region isn't worth (or isn't safe) merging. */
+bool
+Z0::collect_region(BasicBlock const& BB, MergeRegion& region) {
+    std::set<BasicBlock const*> visited, on_stack;
+    std::vector<BasicBlock const*> postorder;
+    unsigned insts = 0;
+    bool ok = true;
+
+    std::function<void(BasicBlock const*)> visit = [&](BasicBlock const* block) {
+        if (!ok || block == region.join) return;
+        if (block == &BB || on_stack.count(block)) { ok = false; return; } // a loop
+        if (!visited.insert(block).second) return;
+        if (visited.size() > Z0MergeMaxBlocks) { ok = false; return; }
+        if (!isa<BranchInst>(block->getTerminator())) { ok = false; return; }
+        for (Instruction const& I : *block) {
+            if (isa<LoadInst>(&I) || isa<StoreInst>(&I)) { ok = false; return; }
+            CallInst const* ci = dyn_cast<CallInst>(&I);
+            if (ci && !(ci->getCalledFunction()
+                        && ci->getCalledFunction()->getName().startswith("llvm.dbg."))) {
+                ok = false; return;
+            }
+            ++insts;
+        }
+        if (insts > Z0MergeMaxInsts) { ok = false; return; }
+        on_stack.insert(block);
+        for (BasicBlock const* succ : successors(block)) {
+            visit(succ);
+        }
+        on_stack.erase(block);
+        postorder.push_back(block);
+    };
+    for (BasicBlock const* succ : successors(&BB)) {
+        visit(succ);
+    }
+    if (!ok) return false;
+
+    // Single entry: everything in the region is only reached through BB
+    for (BasicBlock const* block : postorder) {
+        for (BasicBlock const* pred : predecessors(block)) {
+            if (pred != &BB && !visited.count(pred)) return false;
+        }
+    }
+    region.blocks.assign(postorder.rbegin(), postorder.rend());
+    return true;
+}
+
+/* The value returned by falling straight through from block, if any (null
+ * for a void return). PHIs on the way are resolved for the edges taken, so
+ * the value is one block can see. */
+static Optional<Value const*>
+returned_after(BasicBlock const* block) {
+    std::vector<BasicBlock const*> path;
+    std::unordered_set<BasicBlock const*> seen;
+    while (block && seen.insert(block).second) {
+        path.push_back(block);
+        if (ReturnInst const* ret = dyn_cast<ReturnInst>(block->getTerminator())) {
+            Value const* result = ret->getReturnValue();
+            for (size_t i = path.size() - 1; i > 0; --i) {
+                PHINode const* phi = dyn_cast_or_null<PHINode>(result);
+                if (phi && phi->getParent() == path[i]) {
+                    result = phi->getIncomingValueForBlock(path[i - 1]);
+                }
+            }
+            return result;
+        }
+        block = block->getUniqueSuccessor();
+    }
+    return None;
+}
+
+/* Collects the regions BB's stores go to, and the C0 functions it calls */
+static void
+collect_writes(BasicBlock const& BB, Regions& writes, std::vector<Function const*>& callees) {
+    for (Instruction const& I : BB) {
+        if (StoreInst const* store = dyn_cast<StoreInst>(&I)) {
+            Optional<Location> at = locate(store->getPointerOperand(),
+                                           store->getValueOperand()->getType());
+            if (at) writes.emplace(at->region.key, at->region);
+        } else if (CallInst const* ci = dyn_cast<CallInst>(&I)) {
+            if (callee_name(ci).startswith("_c0_")) callees.push_back(ci->getCalledFunction());
+        }
+    }
+}
+
+/* Collects F's contract for its callers. cc0 checks the postconditions
+ * before every return, so each block that checks them is a return site
+ * whose \result is the value returned straight after it. Sites not followed
+ * straight by a return tell callers nothing (they warn about them), which
+ * only makes callers assume less. */
+void
+Z0::summarize(Function const& F, DominatorTree& dt, Summary& summary) {
+    for (BasicBlock const& BB : F) {
+        DomTreeNode* node = dt.getNode(const_cast<BasicBlock*>(&BB));
+        if (node && node->getIDom()) {
+            summary.dominators.emplace(&BB, node->getIDom()->getBlock());
+        }
+        collect_writes(BB, summary.writes, summary.callees);
+        ReturnSite* site = nullptr;
+        for (Instruction const& I : BB) {
+            CallInst const* ci = dyn_cast<CallInst>(&I);
+            if (!ci || !ci->getCalledFunction()) continue;
+            StringRef name = ci->getCalledFunction()->getName();
+            if (name == "z0_requires") {
+                summary.requires.push_back(ci->getOperand(0));
+            } else if (name == "z0_ensures") {
+                if (!site) {
+                    summary.returns.push_back(ReturnSite{&BB, returned_after(&BB), {}});
+                    site = &summary.returns.back();
+                }
+                site->ensures.push_back(ci->getOperand(0));
+            }
+        }
+    }
+}
+
+/* Adds what each function's callees may store to what it may store to,
+ * until nothing changes (so recursion is fine), then does the same for
+ * loops that call functions */
+void
+Z0::propagate_writes(void) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& entry : summaries) {
+            for (Function const* callee : entry.second.callees) {
+                auto found = summaries.find(callee);
+                if (found == summaries.end() || found->first == entry.first) continue;
+                for (auto const& write : found->second.writes) {
+                    changed = entry.second.writes.insert(write).second || changed;
+                }
+            }
+        }
+    }
+    for (FunctionPlan& plan : plans) {
+        for (auto& loop : plan.loops) {
+            for (Function const* callee : loop.second.callees) {
+                auto found = summaries.find(callee);
+                if (found == summaries.end()) continue;
+                loop.second.writes.insert(found->second.writes.begin(), found->second.writes.end());
+            }
+        }
+    }
+}
+
+/* Whether I is a loop invariant */
+static bool
+is_invariant(Instruction const& I) {
+    CallInst const* ci = dyn_cast<CallInst>(&I);
+    return ci && ci->getCalledFunction()
+        && ci->getCalledFunction()->getName() == "z0_loop_invariant";
+}
+
+/* Plans how to cut each loop (see Z0Checker::cut_loop). A loop's invariants
+ * are the invariant calls in its header and the blocks the header falls
+ * straight into; any others are checked like assertions. The values a loop
+ * computes include its subloops', so going round the outer loop havocs
+ * them too. */
+void
+Z0::cut_loops(LoopInfo& li, FunctionPlan& plan) {
+    std::vector<Loop*> loops(li.begin(), li.end());
+    while (!loops.empty()) {
+        Loop* L = loops.back();
+        loops.pop_back();
+        loops.insert(loops.end(), L->begin(), L->end());
+        BasicBlock const* header = L->getHeader();
+        LoopCut cut;
+        SmallVector<BasicBlock*, 4> latches;
+        L->getLoopLatches(latches);
+        cut.latches.insert(latches.begin(), latches.end());
+        for (BasicBlock const* block : L->blocks()) {
+            for (Instruction const& I : *block) {
+                if (width_of(I.getType())) cut.values.push_back(&I);
+            }
+            collect_writes(*block, cut.writes, cut.callees);
+        }
+        cut.invariants_end = header->getFirstNonPHI();
+        size_t established = 1;
+        for (BasicBlock const* block = header; block; ) {
+            cut.prefix.push_back(block);
+            for (Instruction const& I : *block) {
+                if (!is_invariant(I)) continue;
+                plan.invariants.insert(&I);
+                cut.invariant = true;
+                cut.invariants_end = I.getNextNode();
+                established = cut.prefix.size();
+            }
+            BasicBlock const* next = block->getUniqueSuccessor();
+            if (!next || next == header || !L->contains(next)
+                || next->getUniquePredecessor() != block) break;
+            block = next;
+        }
+        cut.prefix.resize(established);
+        DEBUG(dbgs() << "Will cut loop at " << header->getName() << " ("
+                     << cut.values.size() << " values to havoc)\n");
+        plan.loops.emplace(header, std::move(cut));
+    }
+}
+
+/* Whether running I checks something (and so is worth steering toward) */
+static bool
+is_check(Instruction const& I) {
+    CallInst const* ci = dyn_cast<CallInst>(&I);
+    if (!ci || !ci->getCalledFunction()) return false;
+    StringRef name = ci->getCalledFunction()->getName();
+    return name == "c0_idiv" || name == "c0_imod" || name.startswith("_c0_")
+        || name == "c0_deref" || name == "c0_array_sub" || name == "c0_array_alloc"
+        || (name.startswith("z0") && name != "z0_requires");
+}
+
+/* Works out, for every block, which checks are reachable from it and how
+ * many blocks away, by a breadth-first search from each block. */
+void
+Z0::plan_priorities(Function const& F, FunctionPlan& plan) {
+    for (BasicBlock const& BB : F) {
+        auto& ahead = plan.checks_ahead[&BB];
+        std::unordered_map<BasicBlock const*, unsigned> distance;
+        std::deque<BasicBlock const*> queue;
+        distance.emplace(&BB, 0);
+        queue.push_back(&BB);
+        while (!queue.empty()) {
+            BasicBlock const* block = queue.front();
+            queue.pop_front();
+            unsigned d = distance[block];
+            for (Instruction const& I : *block) {
+                if (is_check(I)) ahead.emplace_back(&I, d);
+            }
+            for (BasicBlock const* succ : successors(block)) {
+                if (distance.emplace(succ, d + 1).second) {
+                    queue.push_back(succ);
+                }
+            }
+        }
+    }
+}
+
+/* Checks functions on `jobs` threads.
+ * Like the serial loop, every function gets a fresh Z0Checker (and so a fresh
+ * z3::context), which keeps counterexamples independent of scheduling.
+ * Reports are printed in module order as soon as every earlier function
+ * has been printed, so the output matches a serial run.
+ */
+void
+Z0::check_parallel(std::vector<FunctionReport>& reports, unsigned jobs) {
+    std::atomic<size_t> next(0);
+    std::vector<bool> done(functions.size(), false);
+    size_t printed = 0;
+    std::mutex print_lock;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < functions.size(); i = next++) {
+            check_one(i, reports[i]);
+            std::lock_guard<std::mutex> guard(print_lock);
+            done[i] = true;
+            while (printed < functions.size() && done[printed]) {
+                if (settings.print) reports[printed].flush();
+                ++printed;
+            }
+        }
+    };
+
+    DEBUG(dbgs() << "Checking " << functions.size() << " functions on " << jobs << " threads\n");
+    std::vector<std::thread> threads;
+    for (unsigned j = 1; j < jobs; ++j) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+/* Erases the c0_assert calls that check's result (directly or cast)
+ * feeds, and the casts in between */
+static void
+erase_asserts(Instruction* check) {
+    std::vector<User*> users(check->user_begin(), check->user_end());
+    for (User* user : users) {
+        if (CastInst* cast = dyn_cast<CastInst>(user)) {
+            erase_asserts(cast);
+            if (cast->use_empty()) cast->eraseFromParent();
+        } else if (CallInst* call = dyn_cast<CallInst>(user)) {
+            if (callee_name(call) == "c0_assert") call->eraseFromParent();
+        }
+    }
+}
+
+bool
+Z0Strip::runOnModule(Module &M) {
+    Z0 const& z0 = getAnalysis<Z0>();
+    std::vector<CallInst*> proved;
+    for (Function &F : M) {
+        if (!F.getName().startswith("_c0_")) continue;
+        bool preconditions = z0.preconditions_proved(F);
+        for (BasicBlock &BB : F) {
+            for (Instruction &I : BB) {
+                CallInst* ci = dyn_cast<CallInst>(&I);
+                if (!ci) continue;
+                StringRef name = callee_name(ci);
+                if (name == "z0_requires" ? preconditions
+                    : (name.startswith("z0_") || name == "c0_idiv" || name == "c0_imod")
+                      && z0.proved(ci)) {
+                    proved.push_back(ci);
+                }
+            }
+        }
+    }
+    DEBUG(dbgs() << "Stripping " << proved.size() << " proved checks\n");
+    for (CallInst* ci : proved) {
+        StringRef name = callee_name(ci);
+        if (name == "c0_idiv" || name == "c0_imod") {
+            Instruction* op = BinaryOperator::Create(
+                name == "c0_idiv" ? Instruction::SDiv : Instruction::SRem,
+                ci->getArgOperand(0), ci->getArgOperand(1), "", ci);
+            op->takeName(ci);
+            ci->replaceAllUsesWith(op);
+        } else {
+            erase_asserts(ci);
+            ci->replaceAllUsesWith(ConstantInt::get(ci->getType(), 1));
+        }
+        ci->eraseFromParent();
+    }
+    return !proved.empty();
+}
 #undef DEBUG_TYPE
 
 // LLVM uses the address of this static member to identify the pass, so the
@@ -180,3 +902,25 @@ Z0::cmp_expr(llvm::CmpInst::Predicate pred, z3::expr a, z3::expr b) {
 char Z0::ID = 0;
 static RegisterPass<Z0>
     X("z0", "17-355: Z0 Symbolic Analysis pass", false, false);
+char Z0Strip::ID = 0;
+static RegisterPass<Z0Strip>
+    Y("z0-strip", "17-355: Remove checks Z0 proved", false, false);
+
+ModulePass*
+createZ0Pass(Z0Settings const& settings) {
+    return new Z0(settings);
+}
+
+std::vector<FunctionResult>
+z0_results(ModulePass const& z0) {
+    std::vector<FunctionResult> results;
+    for (FunctionReport const& report : static_cast<Z0 const&>(z0).function_reports()) {
+        results.push_back(report.result());
+    }
+    return results;
+}
+
+ModulePass*
+createZ0StripPass(void) {
+    return new Z0Strip();
+}
@@ -2,16 +2,28 @@
 #include "llvm/Pass.h"
 #include "llvm/Analysis/LoopPass.h"
 #include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/InstVisitor.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 // #include "llvm/IR/metadata.h"
+#include "llvm/Support/CommandLine.h"
 #include "z3++.h"
 #include "state.h"
+#include "checker.h"
+#include "report.h"
+#include "plan.h"
+#include "worklist.h"
+#include "passes.h"
+#include "proofs.h"
+#include "stats.h"
+#include "store.h"
 
 #include <unordered_map>
 #include <iostream>
@@ -19,22 +31,133 @@
 #include <sstream>
 #include <climits>
 #include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <functional>
+#include <deque>
 
 using namespace llvm;
 
 
 #define DEBUG_TYPE "Z0"
 
+static cl::opt<unsigned> Z0Jobs("z0-jobs",
+    cl::desc("Number of functions to check in parallel (0 = one per core)"),
+    cl::init(1));
+
+static cl::opt<unsigned> Z0PathJobs("z0-path-jobs",
+    cl::desc("Number of threads exploring the paths of each function"),
+    cl::init(1));
+
+static cl::opt<bool> Z0Merge("z0-merge",
+    cl::desc("Merge paths at the post-dominators of branches instead of forking"),
+    cl::init(false));
+
+static cl::opt<unsigned> Z0MergeMaxBlocks("z0-merge-max-blocks",
+    cl::desc("Largest region (in basic blocks) that -z0-merge will merge"),
+    cl::init(16));
+
+static cl::opt<unsigned> Z0MergeMaxInsts("z0-merge-max-insts",
+    cl::desc("Largest region (in instructions) that -z0-merge will merge"),
+    cl::init(256));
+
+static cl::opt<SearchStrategy> Z0Search("z0-search",
+    cl::desc("Order in which paths are explored"),
+    cl::values(
+        clEnumValN(SearchStrategy::DFS, "dfs", "Depth-first (default)"),
+        clEnumValN(SearchStrategy::BFS, "bfs", "Breadth-first"),
+        clEnumValN(SearchStrategy::Priority, "priority", "Closest unchecked assertion first"),
+        clEnumValEnd),
+    cl::init(SearchStrategy::DFS));
+
+static cl::opt<unsigned> Z0MaxPaths("z0-max-paths",
+    cl::desc("Stop checking a function after this many paths (0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0MaxDepth("z0-max-depth",
+    cl::desc("Stop following a path after this many blocks (0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0Unroll("z0-unroll",
+    cl::desc("Unroll loops without invariants up to this many iterations, deepening "
+             "1, 2, 4, ... while time and paths last (0 = havoc them instead)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0Concrete("z0-concrete",
+    cl::desc("Run each function on this many boundary and random inputs before "
+             "checking it symbolically (0 = don't)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0TimeBudget("z0-time-budget",
+    cl::desc("Stop checking a function after this many seconds (0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0ModuleTimeBudget("z0-module-time-budget",
+    cl::desc("Stop checking the module after this many seconds (0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0QueryTimeout("z0-query-timeout",
+    cl::desc("Give up on a solver query after this many milliseconds (0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0QueryRlimit("z0-query-rlimit",
+    cl::desc("Give up on a solver query after this many z3 resource units (0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0MemoryLimit("z0-memory-limit",
+    cl::desc("Megabytes z3 may use before queries come back unknown (0 = no limit)"),
+    cl::init(0));
+
+static cl::opt<bool> Z0Incremental("z0-incremental",
+    cl::desc("Check paths under assumption literals instead of solver push/pop"),
+    cl::init(false));
+
+static cl::opt<unsigned> Z0QueryCache("z0-query-cache",
+    cl::desc("Solver results to remember per function (0 = no query cache)"),
+    cl::init(0));
+
+static cl::opt<bool> Z0Slice("z0-slice",
+    cl::desc("Only send z3 the constraints a query depends on"),
+    cl::init(false));
+
+static cl::opt<bool> Z0Substitute("z0-substitute",
+    cl::desc("Substitute instructions' expressions for their symbols"),
+    cl::init(false));
+
+static cl::opt<bool> Z0Portfolio("z0-portfolio",
+    cl::desc("Race several solver strategies on each check"),
+    cl::init(false));
+
+static cl::opt<unsigned> Z0Abstract("z0-int-abstraction",
+    cl::desc("Milliseconds to try multiplications and divisions over the integers "
+             "before bit-blasting them (0 = never)"),
+    cl::init(0));
+
+static cl::opt<unsigned> Z0Cores("z0-cores",
+    cl::desc("Unsat cores of infeasible paths to remember per function (0 = don't learn any)"),
+    cl::init(0));
+
+static cl::opt<bool> Z0Prepass("z0-prepass",
+    cl::desc("Decide what checks intervals can before asking z3"),
+    cl::init(false));
+
+static cl::opt<bool> Z0Stats("z0-stats",
+    cl::desc("Print Z0's statistics when done"),
+    cl::init(false));
+
+static cl::opt<std::string> Z0ResultCache("z0-result-cache",
+    cl::desc("Keep results in this directory, and reuse them for functions that "
+             "(with what they call) haven't changed"),
+    cl::value_desc("dir"),
+    cl::init(""));
+
 // An analysis pass that symbolically checks contracts.
 class Z0 final : public ModulePass {
 
-    Z0State state;
-    z3::expr int_min_expr = state.bv_val(INT32_MIN, I32);
-    z3::expr zero_expr = state.bv_val(0, I32);
-    z3::expr minusone_expr = state.bv_val(-1, I32);
-    z3::expr true_expr = state.bv_val(1, I1);
-    z3::expr false_expr = state.bv_val(0, I1);
-
     // enum class Verb {
     //     errors=1, unknown=2, everything=3
     // } verbosity;
@@ -43,12 +166,14 @@ class Z0 final : public ModulePass {
 public:
     static char ID;
 
-    Z0() : ModulePass(ID) {}
+    explicit Z0(Z0Settings const& settings = Z0Settings()) : ModulePass(ID), settings(settings) {}
     ~Z0() { }
 
     void getAnalysisUsage(AnalysisUsage &AU) const override {
         AU.setPreservesAll(); /* Doesn't modify the program, so preserve all analyses */
         AU.addRequired<LoopInfoWrapperPass>();
+        AU.addRequired<DominatorTreeWrapperPass>();
+        AU.addRequired<PostDominatorTreeWrapperPass>();
     }
     bool doInitialization(Module &M) override {
         DEBUG(dbgs() << "Z0 pass initializing...\n");
@@ -63,241 +188,215 @@ public:
 
     bool runOnModule(Module &M) override {
         DEBUG(dbgs() << "Z0 pass running...\n");
+        std::unique_lock<std::mutex> counting;
+        if (Z0Stats) {
+            counting = std::unique_lock<std::mutex>(Z0Statistic::counting());
+            Z0Statistic::reset_all();
+        }
+        module_deadline = std::chrono::steady_clock::time_point::max();
+        if (Z0ModuleTimeBudget) {
+            module_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(Z0ModuleTimeBudget);
+        }
+        if (Z0MemoryLimit) {
+            z3::set_param("memory_max_size", std::to_string(Z0MemoryLimit).c_str());
+        }
 
+        /* LLVM analyses aren't thread-safe, so anything needing them
+         * happens here, before any checking starts */
+        functions.clear();
+        plans.clear();
+        summaries.clear();
+        proofs.clear();
+        index.clear();
         for (Function &F : M) {
             if (F.getName().startswith("_c0_")) {
-                state.reset();
-                outs() << "Analyzing function " << F.getName().drop_front(4) << "...\n";
+                index.emplace(&F, functions.size());
+                functions.push_back(&F);
+                proofs.emplace_back(new ProofLog());
+                plans.emplace_back();
                 LoopInfoWrapperPass &info = getAnalysis<LoopInfoWrapperPass>(F);
-                cut_loops(F, info.getLoopInfo());
-                BasicBlock const& entry = F.getEntryBlock();
-                try {
-                    bool doesReturn = analyze_basicblock(entry, nullptr);
-                    if (!doesReturn) {
-                        outs() << "Warning: function never returns. Perhaps an infinite loop or unsatisfiable precondition?\n";
-                    }
-                    outs() << "OK!\n";
-                } catch (StopZ0 e) {
-                    DEBUG(dbgs() << "Z0 stopped cleanly via exception.\n");
-                    errs() << "Z0 Stopped: " << e.why << "\n";
-                    DEBUG(outs() << "Along path: ");
-                    DEBUG(state.show_path(&entry));
-                } catch (z3::exception e) {
-                    errs() << "Internal Error! z3 raised an exception:\n";
-                    errs() << e.msg() << "\n";
+                cut_loops(info.getLoopInfo(), plans.back());
+                DominatorTreeWrapperPass &dom = getAnalysis<DominatorTreeWrapperPass>(F);
+                summarize(F, dom.getDomTree(), summaries[&F]);
+                plans.back().summaries = &summaries;
+                if (Z0Merge) {
+                    PostDominatorTreeWrapperPass &pdt = getAnalysis<PostDominatorTreeWrapperPass>(F);
+                    plan_merges(F, pdt.getPostDomTree(), plans.back());
                 }
+                if (Z0Search == SearchStrategy::Priority) {
+                    plan_priorities(F, plans.back());
+                }
+            }
+        }
+        propagate_writes();
+        store = !Z0ResultCache.empty() ? &ResultStore::at(Z0ResultCache)
+              : settings.remember ? &ResultStore::at("") : nullptr;
+        keys.clear();
+        cache_hits = 0;
+        if (store) {
+            std::string version = result_version();
+            for (Function const* F : functions) {
+                keys.push_back(ResultStore::key(*F, summaries, version, Z0Concrete > 0));
             }
         }
+
+        std::vector<FunctionReport> fresh(functions.size());
+        reports.swap(fresh);
+        unsigned jobs = Z0Jobs ? Z0Jobs : std::thread::hardware_concurrency();
+        if (jobs > functions.size()) jobs = functions.size();
+        if (jobs <= 1) {
+            for (size_t i = 0; i < functions.size(); ++i) {
+                check_one(i, reports[i]);
+                if (settings.print) reports[i].flush();
+            }
+        } else {
+            check_parallel(reports, jobs);
+        }
+        if (store && settings.print) {
+            outs() << "Result cache: " << cache_hits << " hit(s), "
+                   << functions.size() - cache_hits << " miss(es)\n";
+        }
+        if (Z0Stats) {
+            Z0Statistic::print_all(errs());
+        }
         DEBUG(dbgs() << "Z0 pass finished.\n");
         return false;
     }
 
-private: /* Z0-specific logic */
-    template <typename T>
-    std::string to_string(T e) {
-        std::stringstream ss;
-        ss << e;
-        return ss.str();
-    }
+    /* What checking each function came to, in module order */
+    std::vector<FunctionReport> const& function_reports(void) const { return reports; }
+
+private:
+    Z0Settings const settings;
+    /* The functions being checked, and what we worked out about them */
+    std::vector<Function const*> functions;
+    std::vector<FunctionPlan> plans;
+    /* Each function's contract, for checking calls to it without running it */
+    Summaries summaries;
+    /* What checking each function proved, and where each function is */
+    std::vector<std::unique_ptr<ProofLog>> proofs;
+    std::unordered_map<Function const*, size_t> index;
+    std::vector<FunctionReport> reports;
+    /* Where results are kept between runs (if anywhere), and each
+     * function's key there */
+    ResultStore* store = nullptr;
+    std::vector<std::string> keys;
+    std::atomic<unsigned> cache_hits{0};
+    /* Functions that haven't finished by then are stopped or skipped */
+    std::chrono::steady_clock::time_point module_deadline;
+
+    void cut_loops(LoopInfo& li, FunctionPlan& plan);
+    void summarize(Function const& F, DominatorTree& dt, Summary& summary);
+    void propagate_writes(void);
+    void plan_merges(Function const& F, PostDominatorTree& pdt, FunctionPlan& plan);
+    bool collect_region(BasicBlock const& BB, MergeRegion& region);
+    void plan_priorities(Function const& F, FunctionPlan& plan);
 
-    void cut_loops(Function &F, LoopInfo &li){
-        // loop transformation code would go here
+    SearchConfig search_config(void) const {
+        SearchConfig config;
+        config.strategy = Z0Search;
+        config.max_paths = Z0MaxPaths;
+        config.max_depth = Z0MaxDepth;
+        config.time_budget = Z0TimeBudget;
+        config.max_unroll = Z0Unroll;
+        config.concrete_runs = Z0Concrete;
+        config.module_deadline = module_deadline;
+        config.cancelled = settings.cancelled;
+        config.solver.incremental = Z0Incremental;
+        config.solver.cache_size = Z0QueryCache;
+        config.solver.slice = Z0Slice;
+        config.solver.substitute = Z0Substitute;
+        config.solver.query_timeout = Z0QueryTimeout;
+        config.solver.query_rlimit = Z0QueryRlimit;
+        config.solver.portfolio = Z0Portfolio;
+        config.solver.abstract_timeout = Z0Abstract;
+        config.solver.core_limit = Z0Cores;
+        config.solver.prepass = Z0Prepass;
+        return config;
     }
 
-    bool is_reachable(void) {
-        switch (state.solver.check()) {
-            case z3::unknown:
-                DEBUG(errs() << "***Path could not be confirmed reachable, assuming it is***\n");
-            case z3::sat:
-                return true;
-            case z3::unsat:
-                DEBUG(dbgs() << "is_reachable is false:\n");
-                DEBUG(dbgs() << to_string(state.solver.assertions()));
-                DEBUG(dbgs() << "\nalong path:\n");
-                DEBUG(state.show_path(nullptr));
-                return false;
-        }
-        __builtin_unreachable();
+    /* Everything besides the IR that results depend on: the version of Z0's
+     * checking (ResultFormat), the version of z3, and every option that can
+     * change what is printed */
+    std::string result_version(void) const {
+        unsigned major, minor, build, revision;
+        Z3_get_version(&major, &minor, &build, &revision);
+        std::string version;
+        raw_string_ostream os(version);
+        os << ResultFormat
+           << " z3 " << major << "." << minor << "." << build << "." << revision
+           << " merge " << Z0Merge << " " << Z0MergeMaxBlocks << " " << Z0MergeMaxInsts
+           << " search " << unsigned(Z0Search.getValue()) << " paths " << Z0MaxPaths
+           << " depth " << Z0MaxDepth << " unroll " << Z0Unroll << " concrete " << Z0Concrete
+           << " budget " << Z0TimeBudget << " timeout " << Z0QueryTimeout
+           << " rlimit " << Z0QueryRlimit << " memory " << Z0MemoryLimit
+           << " incremental " << Z0Incremental << " cache " << Z0QueryCache
+           << " slice " << Z0Slice << " substitute " << Z0Substitute
+           << " portfolio " << Z0Portfolio << " abstract " << Z0Abstract
+           << " cores " << Z0Cores << " prepass " << Z0Prepass;
+        return os.str();
     }
 
-    bool analyze_basicblock(BasicBlock const& BB, BasicBlock const* from) {
-        DEBUG(dbgs() << "Analyzing Basic Block " << BB.getName());
-        if (from == nullptr) {
-            DEBUG(dbgs() << " (entry block):\n");
-        } else {
-            DEBUG(dbgs() << " (from " << from->getName() << "):\n");
-        }
-        // DEBUG(BB->dump());
-        TerminatorInst const* term = BB.getTerminator();
-        BasicBlock::const_iterator it = BB.begin();
-        if (from != nullptr) {
-            auto nonPhi = BB.getFirstNonPHI();
-            while (&*it != nonPhi) {
-                PHINode const* phi = cast<PHINode>(&*it);
-                Value const* phiVal = phi->getIncomingValueForBlock(from);
-                state.assert_eq(state.z3_repr(phi), state.z3_repr(phiVal));
-                ++it;
-            }
+    void check_one(size_t i, FunctionReport& report) {
+        auto start = std::chrono::steady_clock::now();
+        report.name = functions[i]->getName().drop_front(4).str();
+        if (settings.cancelled && *settings.cancelled) {
+            report.find(Finding::Stop, "Cancelled");
+            return;
         }
-        try {
-            while (&*it != term) {
-                analyze_instruction(&*it);
-                ++it;
-            }
-        } catch (UnreachablePath _) {
-            return false;
+        if (store && store->load(keys[i], *functions[i], report, *proofs[i])) {
+            ++cache_hits;
+            report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return;
         }
-        bool doesReturn = false;
-
-        if (term->getOpcode() == Instruction::Ret) {
-            doesReturn = is_reachable();
-        } else if (BranchInst const* br = dyn_cast<BranchInst>(term)) {
-            // The true branch is the first successor
-
-            if (br->isConditional()) {
-                Value const* cond = br->getCondition();
-                z3::expr cond_expr = state.z3_repr(cond);
-                {
-                    BasicBlock const* next = br->getSuccessor(0);
-                    state.push(next);
-                    state.assert_eq(cond_expr, true_expr);
-                    if (is_reachable()) {
-                        try { doesReturn |= analyze_basicblock(*next, &BB);
-                        } catch (UnreachablePath _){}
-                    }
-                    state.pop();
-                }{
-                    BasicBlock const* next = br->getSuccessor(1);
-                    state.push(next);
-                    state.assert_eq(cond_expr, false_expr);
-                    if (is_reachable()) {
-                        try { doesReturn |= analyze_basicblock(*next, &BB);
-                        } catch (UnreachablePath u){}
-                    }
-                    state.pop();
-                }
-            } else { // unconditional branch
-                BasicBlock const* next = br->getSuccessor(0);
-                state.push(next);
-                try {
-                    doesReturn |= analyze_basicblock(*next, &BB);
-                } catch (UnreachablePath u){}
-                state.pop();
-            }
-        } else if (isa<UnreachableInst>(term)) {
-            // If LLVM can detect this is impossible with
-            // its few analyses, then it's probably pretty simple/intended
-            DEBUG(dbgs() << "Assuming trivially unreachable path is intended\n");
-            doesReturn = true;
+        if (Z0PathJobs > 1) {
+            Z0Checker::check_function_parallel(*functions[i], plans[i], search_config(),
+                                               report, *proofs[i], Z0PathJobs);
         } else {
-            DEBUG(term->dump());
-            throw StopZ0("Unknown basic block terminator");
+            Z0Checker checker;
+            checker.check_function(*functions[i], plans[i], search_config(), report, *proofs[i]);
         }
-        return doesReturn;
+        if (store) store->save(keys[i], *functions[i], report, *proofs[i]);
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     }
 
-    void analyze_instruction(Instruction const* instr) {
-        if (CallInst const* ci = dyn_cast<CallInst>(instr)) {
-            DEBUG(instr->dump());
-            analyze_call(ci);
-        } else if (isa<PHINode>(instr)) {
-            DEBUG(instr->dump());
-            assert(false && "PHI nodes shouldn't appear in analyze_instruction");
-        } else if (instr->getNumOperands() == 2) {
-            analyze_binop(instr);
-        } else if (instr->getNumOperands() == 1) {
-            analyze_unaryop(instr);
-        } else {
-            DEBUG(dbgs() << "Unknown instruction encountered:\n");
-            DEBUG(instr->dump());
-            throw StopZ0("Unknown instruction encountered\n");
-        }
+    void check_parallel(std::vector<FunctionReport>& reports, unsigned jobs);
+
+public:
+    /* Whether the check (a z0_* call other than z0_requires, or a runtime
+     * check) holds on every path reaching it */
+    bool proved(Instruction const* check) const {
+        auto it = index.find(check->getFunction());
+        return it != index.end() && proofs[it->second]->proved(check);
     }
 
-    void analyze_call(CallInst const* ci) {
-        StringRef name = ci->getCalledFunction()->getName();
-        if (name.startswith("z0")) {
-            analyze_z0_assert(ci);
-        } else if (name == "c0_idiv") {
-            z3::expr a = state.z3_repr(ci->getOperand(0));
-            z3::expr b = state.z3_repr(ci->getOperand(1));
-            z3::expr me = state.bv_constant(ci);
-            check_div(a, b);
-            state.assert_eq(me, binop_expr(Instruction::SDiv, a, b));
-        } else if (name == "c0_imod") {
-            z3::expr a = state.z3_repr(ci->getOperand(0));
-            z3::expr b = state.z3_repr(ci->getOperand(1));
-            z3::expr me = state.bv_constant(ci);
-            check_div(a, b);
-            state.assert_eq(me, binop_expr(Instruction::SRem, a, b));
-        } else if (name == "llvm.dbg.value") {
-            /* This intrinsic provides information when a user source variable
-            is set to a new value.
-            The first argument is the new value (wrapped as metadata).
-            The second argument is the offset in the user source variable
-                where the new value is written.
-            The third argument is a local variable containing a description
-                of the variable.
-            The fourth argument is a complex expression.*/
-            auto const* val_wrap = llvm::cast<MetadataAsValue>(ci->getOperand(0));
-            auto const* lv_wrap = llvm::cast<MetadataAsValue>(ci->getOperand(2));
-            auto const* val = llvm::cast<ValueAsMetadata>(val_wrap->getMetadata());
-            auto const* lv = llvm::cast<DILocalVariable>(lv_wrap->getMetadata());
-            DEBUG(dbgs() << "Got assignment to value: " << lv->getName() << " = " << *val << "\n");
-            if (lv->getName().startswith("_c0v_") || lv->getName() == "_c0t__result") {
-                state.update_ident(lv, val);
-            }
-        } else if (name == "llvm.dbg.declare") {
-            DEBUG(dbgs() << "(Ignoring variable declaration.)\n");
-            /* ignore */
-        } else {
-            throw StopZ0("Unknown function \"" + std::string(name.begin(), name.end()) + "\" called");
-            assert(false);
+    /* Whether F's preconditions hold at every call to it. The runtime
+     * calls main, and a function whose address is taken could be called
+     * from anywhere. */
+    bool preconditions_proved(Function const& F) const {
+        if (F.getName() == "_c0_main") return false;
+        for (User const* user : F.users()) {
+            CallInst const* call = dyn_cast<CallInst>(user);
+            if (!call || call->getCalledFunction() != &F || !proved(call)) return false;
         }
+        return true;
     }
+};
 
-    bool is_precondition(CallInst const* ci) {
-        return ci->getCalledFunction()->getName() == "z0_requires";
-    }
+/* Rewrites a module Z0 has checked so that the checks it proved no longer
+ * run: proved z0_* calls (and the c0_assert calls they feed) go, and proved
+ * c0_idiv and c0_imod calls become plain sdiv and srem. Checks that failed,
+ * or that Z0 couldn't decide, stay. */
+class Z0Strip final : public ModulePass {
+public:
+    static char ID;
 
-    void check_div(z3::expr a, z3::expr b);
-
-    void analyze_z0_assert(CallInst const* ci);
-
-    void analyze_binop(Instruction const* instr) {
-        assert(instr->getNumOperands() == 2 && "not a binop!");
-        z3::expr instrconst = state.bv_constant(instr);
-        z3::expr a = state.z3_repr(instr->getOperand(0));
-        z3::expr b = state.z3_repr(instr->getOperand(1));
-        try {
-            if (ICmpInst const* icmp = dyn_cast<ICmpInst>(instr)) {
-                z3::expr c = cmp_expr(icmp->getPredicate(), a, b);
-                state.assert_eq(instrconst, z3::ite(c, true_expr, false_expr));
-            } else {
-                z3::expr c = binop_expr(instr->getOpcode(), a, b);
-                state.assert_eq(instrconst, c);
-            }
-        } catch (StopZ0 e) {
-            DEBUG(instr->dump());
-            throw e;
-        }
-    }
-    void analyze_unaryop(Instruction const* instr) {
-        z3::expr instrconst = state.bv_constant(instr);
-        if (auto const* icast = dyn_cast<CastInst>(instr)) {
-            state.assert_eq(instrconst, cast_expr(icast));
-        } else {
-            DEBUG(instr->dump());
-            throw StopZ0("Unknown unary operator");
-        }
+    Z0Strip() : ModulePass(ID) {}
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+        AU.addRequired<Z0>();
     }
 
-    /* Helper functions that are big and not very interesting are put into the
-     * .cpp file to help reduce clutter and make the main algorithm more readable
-     */
-    z3::expr cmp_expr(llvm::CmpInst::Predicate pred, z3::expr a, z3::expr b);
-    z3::expr binop_expr(unsigned opcode, z3::expr a, z3::expr b);
-    z3::expr cast_expr(CastInst const* icmp);
-    void display_counterexample(void);
+    bool runOnModule(Module &M) override;
 };
 #undef DEBUG_TYPE